@@ -0,0 +1,90 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "hittable.h"
+
+#include <vector>
+
+template <typename T>
+class keyframe_track {
+    public:
+        void add(double time, const T& value) {
+            // Keys may be added in any order; they are kept sorted by time.
+            auto it = keys.begin();
+            while (it != keys.end() && it->time <= time) {
+                ++it;
+            }
+            keys.insert(it, key{ time, value });
+        }
+
+        bool empty() const { return keys.empty(); }
+
+        T at(double time) const {
+            // Linearly interpolates between the surrounding keys, holding the first and last
+            // values outside of the keyed range.
+            if (time <= keys.front().time) return keys.front().value;
+            if (time >= keys.back().time)  return keys.back().value;
+
+            size_t i = 1;
+            while (keys[i].time < time) {
+                i++;
+            }
+
+            const key& k0 = keys[i - 1];
+            const key& k1 = keys[i];
+            double a = (time - k0.time) / (k1.time - k0.time);
+            return (1 - a) * k0.value + a * k1.value;
+        }
+
+    private:
+        struct key {
+            double time;
+            T      value;
+        };
+
+        std::vector<key> keys;
+};
+
+class animation {
+    public:
+        // Everything a frame needs from the animation, evaluated before `apply` changes the scene.
+        struct frame_state {
+            point3            lookfrom;
+            point3            lookat;
+            std::vector<vec3> offsets;
+        };
+
+        keyframe_track<point3> lookfrom;
+        keyframe_track<point3> lookat;
+
+        void animate(shared_ptr<translate> object, const keyframe_track<vec3>& track) {
+            objects.push_back(object);
+            tracks.push_back(track);
+        }
+
+        frame_state evaluate(double time, const point3& default_lookfrom, const point3& default_lookat) const {
+            // Only reads the keyframes, so it is safe to call while the scene is being rendered.
+            frame_state state;
+            state.lookfrom = lookfrom.empty() ? default_lookfrom : lookfrom.at(time);
+            state.lookat   = lookat.empty() ? default_lookat : lookat.at(time);
+
+            state.offsets.reserve(tracks.size());
+            for (const auto& track : tracks) {
+                state.offsets.push_back(track.at(time));
+            }
+            return state;
+        }
+
+        void apply(const frame_state& state) const {
+            // Moves the animated objects. Must not run while the scene is being rendered.
+            for (size_t i = 0; i < objects.size(); i++) {
+                objects[i]->set_offset(state.offsets[i]);
+            }
+        }
+
+    private:
+        std::vector<shared_ptr<translate>> objects;
+        std::vector<keyframe_track<vec3>>  tracks;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "common.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "dynamic_bvh.h"
+#include "grid.h"
+#include "hittable_list.h"
+#include "scenes.h"
+#include "variant_scene.h"
+
+#include <chrono>
+#include <thread>
+
+// Renders the main.cpp scene headlessly through different scene representations and reports how
+// long each takes to build and to trace. Every render runs on a fresh thread, so all of them draw the same random
+// numbers and should produce identical images.
+//
+// Optional flags:
+//   --width <pixels>  image width (default 200)
+//   --spp <samples>   samples per pixel (default 10)
+
+template <typename world_type>
+double timed_render(camera& cam, const world_type& world, const std::string& filename) {
+    double seconds = 0;
+    std::thread([&] {
+        auto start = std::chrono::steady_clock::now();
+        cam.render_to_file(world, filename);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }).join();
+    return seconds;
+}
+
+template <typename build_function>
+auto timed_build(const char* name, build_function build) {
+    auto start  = std::chrono::steady_clock::now();
+    auto result = build();
+    std::clog << name << " build: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+    return result;
+}
+
+bool same_file(const std::string& a, const std::string& b) {
+    std::ifstream file_a(a), file_b(b);
+    return std::string(std::istreambuf_iterator<char>(file_a), {}) == std::string(std::istreambuf_iterator<char>(file_b), {});
+}
+
+int main(int argc, char* argv[]) {
+    int image_width       = 200;
+    int samples_per_pixel = 10;
+    for (int i = 1; i + 1 < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--width") {
+            image_width = std::stoi(argv[++i]);
+        }
+        else if (arg == "--spp") {
+            samples_per_pixel = std::stoi(argv[++i]);
+        }
+    }
+
+    hittable_list         world;
+    shared_ptr<translate> glass_sphere = create_world_final(world);
+
+    camera cam;
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = image_width;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth         = 50;
+    cam.vfov              = 20;
+    cam.lookfrom          = point3(13, 2, 3);
+    cam.lookat            = point3(0, 0, 0);
+    cam.vup               = vec3(0, 1, 0);
+    cam.defocus_angle     = 0.6;
+    cam.focus_dist        = 10;
+    cam.show_progress     = false;
+
+    auto closed_world = timed_build("variant_scene", [&] { return make_shared<variant_scene>(world); });
+    auto world_bvh    = timed_build("bvh", [&] { return make_shared<bvh>(world); });
+    auto world_grid   = timed_build("grid", [&] { return make_shared<grid>(world); });
+    int  glass_proxy  = -1;
+    auto world_edited = timed_build("dynamic_bvh", [&] {
+        auto tree = make_shared<dynamic_bvh>();
+        for (const auto& object : world.objects) {
+            int proxy = tree->insert(object);
+            if (object == glass_sphere) {
+                glass_proxy = proxy;
+            }
+        }
+        return tree;
+    });
+
+    // Edit the dynamic tree the way an editor would, ending with the same scene so the image can
+    // still be compared: add and remove a batch of spheres, and move the glass sphere away and back.
+    auto edit_start = std::chrono::steady_clock::now();
+    {
+        auto             extra_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+        std::vector<int> extra;
+        for (int i = 0; i < 200; i++) {
+            extra.push_back(world_edited->insert(make_shared<sphere>(point3(i % 20 - 10, 0.2, i / 20 - 10), 0.2, extra_material)));
+        }
+        for (int proxy : extra) {
+            world_edited->remove(proxy);
+        }
+
+        if (glass_sphere && glass_proxy >= 0) {
+            vec3 base_offset = glass_sphere->get_offset();
+            for (int step = 1; step <= 20; step++) {
+                glass_sphere->set_offset(base_offset + vec3(0, 0.25 * (step <= 10 ? step : 20 - step), 0));
+                world_edited->move(glass_proxy);
+            }
+        }
+    }
+    std::clog << "dynamic_bvh edits: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - edit_start).count() << " ms\n";
+
+    std::clog << "Scene: " << world.objects.size() << " objects, " << closed_world->closed_count()
+              << " in the closed set, " << closed_world->open_count() << " left on the virtual path\n";
+    std::clog << "dynamic_bvh: height " << world_edited->height() << ", node area " << world_edited->area_ratio()
+              << "x the root's\n";
+    std::clog << "Grid: " << world_grid->resolution(0) << 'x' << world_grid->resolution(1) << 'x' << world_grid->resolution(2)
+              << " cells, " << world_grid->large_object_count() << " large objects outside\n";
+
+    double list_seconds = timed_render(cam, static_cast<const hittable&>(world), "results/bench_list.ppm");
+    std::clog << "Virtual dispatch (hittable_list): " << list_seconds << " s\n";
+
+    auto report = [&](const char* name, double seconds, const std::string& filename) {
+        std::clog << name << seconds << " s (" << list_seconds / seconds << "x), image "
+                  << (same_file("results/bench_list.ppm", filename) ? "matches" : "DIFFERS") << '\n';
+    };
+
+    report("Closed dispatch (variant_scene):  ", timed_render(cam, *closed_world, "results/bench_variant.ppm"), "results/bench_variant.ppm");
+    report("Hierarchy (bvh):                  ", timed_render(cam, static_cast<const hittable&>(*world_bvh), "results/bench_bvh.ppm"), "results/bench_bvh.ppm");
+    report("Uniform grid (grid):              ", timed_render(cam, static_cast<const hittable&>(*world_grid), "results/bench_grid.ppm"), "results/bench_grid.ppm");
+    report("Edited hierarchy (dynamic_bvh):   ", timed_render(cam, static_cast<const hittable&>(*world_edited), "results/bench_dynamic.ppm"), "results/bench_dynamic.ppm");
+    return 0;
+}
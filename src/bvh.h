@@ -0,0 +1,253 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <vector>
+
+class bvh : public hittable {
+    public:
+        bvh(const hittable_list& list) : objects{ list.objects } {
+            build();
+        }
+
+        bvh(const std::vector<shared_ptr<hittable>>& objects) : objects{ objects } {
+            build();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (nodes.empty()) {
+                return false;
+            }
+
+            bool hit_anything = false;
+            int  stack[64];
+            int  stack_size = 0;
+            stack[stack_size++] = 0;
+
+            while (stack_size > 0) {
+                const node& n = nodes[stack[--stack_size]];
+                if (!n.bbox.hit(r, ray_t)) {
+                    continue;
+                }
+
+                if (n.count > 0) {
+                    for (int i = n.first; i < n.first + n.count; i++) {
+                        if (objects[i]->hit(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                    continue;
+                }
+
+                // Push the far child first so the near child is visited first and shrinks `ray_t`.
+                int left  = n.first;
+                int right = n.first + 1;
+                if (r.direction()[n.axis] < 0) {
+                    std::swap(left, right);
+                }
+                stack[stack_size++] = right;
+                stack[stack_size++] = left;
+            }
+
+            return hit_anything;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            if (nodes.empty()) {
+                return false;
+            }
+
+            int stack[64];
+            int stack_size = 0;
+            stack[stack_size++] = 0;
+
+            while (stack_size > 0) {
+                const node& n = nodes[stack[--stack_size]];
+                if (!n.bbox.hit(r, ray_t)) {
+                    continue;
+                }
+
+                if (n.count > 0) {
+                    for (int i = n.first; i < n.first + n.count; i++) {
+                        if (objects[i]->occluded(r, ray_t)) {
+                            return true;
+                        }
+                    }
+                    continue;
+                }
+
+                stack[stack_size++] = n.first + 1;
+                stack[stack_size++] = n.first;
+            }
+
+            return false;
+        }
+
+        aabb bounding_box() const override {
+            return nodes.empty() ? aabb() : nodes[0].bbox;
+        }
+
+        void refit() {
+            // Recomputes every node's bounds from the current object bounds while keeping the tree
+            // topology. Much cheaper than a rebuild when objects have only moved a little, e.g.
+            // between the frames of an animation. Children are always stored after their parent,
+            // so a reverse sweep visits them first.
+            for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+                node& n = nodes[i];
+                if (n.count > 0) {
+                    n.bbox = aabb();
+                    for (int j = n.first; j < n.first + n.count; j++) {
+                        n.bbox = aabb(n.bbox, objects[j]->bounding_box());
+                    }
+                }
+                else {
+                    n.bbox = aabb(nodes[n.first].bbox, nodes[n.first + 1].bbox);
+                }
+            }
+        }
+
+        size_t node_count() const { return nodes.size(); }
+
+    private:
+        struct node {
+            aabb bbox;
+            int  first;  // First object for a leaf, left child for an interior node (right is first + 1)
+            int  count;  // Number of objects in a leaf, 0 for an interior node
+            int  axis;   // Split axis of an interior node
+        };
+
+        static const int max_leaf_size = 4;
+        static const int bin_count     = 12;
+
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<node>                 nodes;
+
+        void build() {
+            nodes.clear();
+            if (objects.empty()) {
+                return;
+            }
+
+            std::vector<aabb> boxes(objects.size());
+            for (size_t i = 0; i < objects.size(); i++) {
+                boxes[i] = objects[i]->bounding_box();
+            }
+
+            nodes.reserve(2 * objects.size());
+            nodes.push_back(node{ aabb(), 0, int(objects.size()), 0 });
+            subdivide(0, boxes, 0);
+        }
+
+        void subdivide(int node_index, std::vector<aabb>& boxes, int depth) {
+            int first = nodes[node_index].first;
+            int count = nodes[node_index].count;
+
+            aabb bbox;
+            aabb centroid_bounds;
+            for (int i = first; i < first + count; i++) {
+                bbox = aabb(bbox, boxes[i]);
+                point3 c = boxes[i].centroid();
+                centroid_bounds = aabb(centroid_bounds, aabb(interval(c.x(), c.x()), interval(c.y(), c.y()), interval(c.z(), c.z())));
+            }
+            nodes[node_index].bbox = bbox;
+
+            if (count <= max_leaf_size || depth >= 60) {
+                return;
+            }
+
+            int    axis = centroid_bounds.longest_axis();
+            double split;
+            if (!find_sah_split(first, count, boxes, centroid_bounds, axis, split)) {
+                return;
+            }
+
+            // Partition objects (and their cached boxes) around the split plane.
+            int mid = first;
+            for (int i = first; i < first + count; i++) {
+                if (boxes[i].centroid()[axis] < split) {
+                    std::swap(boxes[i], boxes[mid]);
+                    std::swap(objects[i], objects[mid]);
+                    mid++;
+                }
+            }
+
+            if (mid == first || mid == first + count) {
+                // All centroids coincide along the axis; fall back to a median split.
+                mid = first + count / 2;
+            }
+
+            int left = int(nodes.size());
+            nodes.push_back(node{ aabb(), first, mid - first, 0 });
+            nodes.push_back(node{ aabb(), mid, first + count - mid, 0 });
+
+            nodes[node_index].first = left;
+            nodes[node_index].count = 0;
+            nodes[node_index].axis  = axis;
+
+            subdivide(left, boxes, depth + 1);
+            subdivide(left + 1, boxes, depth + 1);
+        }
+
+        bool find_sah_split(int first, int count, const std::vector<aabb>& boxes,
+                            const aabb& centroid_bounds, int axis, double& split) const {
+            // Binned surface area heuristic. Returns false if keeping a leaf is cheaper.
+            const interval& extent = centroid_bounds.axis_interval(axis);
+            if (extent.size() <= 0) {
+                return false;
+            }
+
+            aabb bin_boxes[bin_count];
+            int  bin_counts[bin_count] = {};
+            double scale = bin_count / extent.size();
+
+            for (int i = first; i < first + count; i++) {
+                int b = std::min(bin_count - 1, int((boxes[i].centroid()[axis] - extent.min) * scale));
+                bin_boxes[b] = aabb(bin_boxes[b], boxes[i]);
+                bin_counts[b]++;
+            }
+
+            // Sweep from the right to get the cost of every right-hand side, then from the left.
+            double right_area[bin_count];
+            int    right_count[bin_count];
+            aabb   running;
+            int    running_count = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                running = aabb(running, bin_boxes[b]);
+                running_count += bin_counts[b];
+                right_area[b]  = running.surface_area();
+                right_count[b] = running_count;
+            }
+
+            double best_cost = infinity;
+            int    best_bin  = -1;
+            running = aabb();
+            running_count = 0;
+            for (int b = 1; b < bin_count; b++) {
+                running = aabb(running, bin_boxes[b - 1]);
+                running_count += bin_counts[b - 1];
+                double cost = running_count * running.surface_area() + right_count[b] * right_area[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_bin  = b;
+                }
+            }
+
+            aabb parent;
+            for (int i = first; i < first + count; i++) {
+                parent = aabb(parent, boxes[i]);
+            }
+
+            if (best_bin < 0 || best_cost >= count * parent.surface_area()) {
+                return false;
+            }
+
+            split = extent.min + best_bin / scale;
+            return true;
+        }
+};
+
+#endif
@@ -3,8 +3,19 @@
 
 #include <SFML/Graphics.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "animation.h"
+#include "bvh.h"
+#include "environment.h"
 #include "hittable.h"
 #include "material.h"
+#include "streamed_scene.h"
+#include "variant_scene.h"
 
 void write_progress_bar(int current_percentage) {
     int barWidth = 50;
@@ -49,10 +60,15 @@ class camera {
         double defocus_angle     = 0;
         double focus_dist        = 10;
 
-        void render(const hittable& world) {
-            std::ofstream   output_file;
-            std::string     output_filename;
+        double target_frame_time = 1.0 / 15;          // Interactive frame budget, in seconds
+        double move_speed        = 2.0;               // Navigation speed, in world units per second
+
+        bool   record_cost       = false;             // Record the per-pixel cost AOV (see render_cost.h)
+        bool   show_progress     = true;              // Draw a progress bar for headless renders
+
+        shared_ptr<environment> background;           // HDR environment light; the gradient skybox if null
 
+        void render(const hittable& world) {
             initialize();
 
             sf::RenderWindow window(sf::VideoMode(1440, 810), "Raytracer");
@@ -61,9 +77,7 @@ class camera {
 
             clearSampleBuffer(sample_buffer);
 
-            int current_samples = 0;
-
-            sf::Uint8* pixels = new sf::Uint8[image_width * image_height * 4];
+            sf::Uint8* pixels = new sf::Uint8[image_width * image_height * 4]();
 
             sf::Texture texture;
             texture.create(image_width, image_height);
@@ -73,6 +87,17 @@ class camera {
           
             texture.update(pixels);
 
+            sf::Clock frame_clock;
+            sf::Clock stats_clock;
+            double    last_frame_time   = 0;
+            double    seconds_per_pixel = 0;   // Running estimate of the cost of one camera sample
+            int       preview_stride    = 0;   // Greater than 1 while showing a reduced-resolution view
+            int       preview_row       = 0;   // First image row of the next row of preview blocks
+            int       next_row          = 0;   // Next row of the full-resolution pass to accumulate
+            long long stats_pixels      = 0;
+            int       stats_frames      = 0;
+            int       cost_view         = -1;  // Cost channel shown instead of the render, -1 for none
+
             while (window.isOpen())
             {
                 sf::Event event;
@@ -80,13 +105,87 @@ class camera {
                 {
                     if (event.type == sf::Event::Closed)
                         window.close();
+
+                    if (event.type == sf::Event::KeyPressed && record_cost) {
+                        if (event.key.code == sf::Keyboard::H) {
+                            // Cycle through the render and each cost channel.
+                            cost_view = (cost_view + 2) % (cost_map::channel_count + 1) - 1;
+                        }
+                        if (event.key.code == sf::Keyboard::P) {
+                            write_pixels(pixels, "results/view.ppm");
+                            cost.write("results/view");
+                        }
+                    }
+                }
+
+                if (window.hasFocus() && navigate(last_frame_time)) {
+                    // The view moved, so everything accumulated so far is stale.
+                    initialize();
+                    clearSampleBuffer(sample_buffer);
+                    next_row       = 0;
+                    preview_row    = 0;
+                    preview_stride = budget_stride(seconds_per_pixel);
                 }
 
-                updateSampleBuffer(world, sample_buffer);
+                frame_clock.restart();
+
+                long long traced_pixels = 0;
+                if (preview_stride > 1) {
+                    // Trace rows of preview blocks until the frame budget is spent. Once the whole
+                    // image is covered at this stride, refine at half the stride, down to the
+                    // full-resolution pass, unless the view moves again.
+                    do {
+                        traced_pixels += updatePreviewRow(world, pixels, sample_buffer, preview_stride, preview_row);
+                        preview_row += preview_stride;
+                        if (preview_row >= image_height) {
+                            preview_row     = 0;
+                            preview_stride /= 2;
+                        }
+                    } while (preview_stride > 1 && frame_clock.getElapsedTime().asSeconds() < target_frame_time);
+                }
+                else {
+                    // Accumulate whole rows until the frame budget is spent, carrying on from where
+                    // the previous frame stopped.
+                    do {
+                        updateSampleRow(world, sample_buffer, next_row);
+                        traced_pixels += image_width;
+                        next_row = (next_row + 1) % image_height;
+                    } while (frame_clock.getElapsedTime().asSeconds() < target_frame_time);
+
+                    updatePixels(pixels, sample_buffer);
+                }
 
-                current_samples += 1;
+                last_frame_time = frame_clock.getElapsedTime().asSeconds();
+                seconds_per_pixel = (seconds_per_pixel == 0)
+                                  ? last_frame_time / traced_pixels
+                                  : 0.8 * seconds_per_pixel + 0.2 * last_frame_time / traced_pixels;
+
+                stats_pixels += traced_pixels;
+                stats_frames += 1;
+                if (stats_clock.getElapsedTime().asSeconds() >= 1.0) {
+                    double    elapsed          = stats_clock.restart().asSeconds();
+                    double    frame_ms         = 1000.0 * elapsed / stats_frames;
+                    long long pixels_per_frame = stats_pixels / stats_frames;
+
+                    std::string stats = std::to_string(int(frame_ms)) + " ms/frame, "
+                                      + std::to_string(pixels_per_frame) + " px/frame";
+                    window.setTitle("Raytracer - " + stats);
+                    std::clog << stats << '\n';
+
+                    stats_pixels = 0;
+                    stats_frames = 0;
+                }
 
-                updatePixels(pixels, sample_buffer, current_samples);
+                if (cost_view >= 0) {
+                    // Overwrites the displayed pixels; the next frame restores them from the samples.
+                    std::vector<color> heatmap = cost.heatmap(cost_map::channel(cost_view));
+                    for (int k = 0; k < image_width * image_height; k++) {
+                        pixels[4 * k + 0] = sf::Uint8(255 * heatmap[k].x());
+                        pixels[4 * k + 1] = sf::Uint8(255 * heatmap[k].y());
+                        pixels[4 * k + 2] = sf::Uint8(255 * heatmap[k].z());
+                        pixels[4 * k + 3] = 255;
+                    }
+                }
 
                 texture.update(pixels);
 
@@ -94,6 +193,80 @@ class camera {
                 window.draw(sprite);
                 window.display();
             }
+
+            delete[] sample_buffer;
+            delete[] pixels;
+        }
+
+        template <typename world_type>
+        bool render_to_file(const world_type& world, const std::string& filename) {
+            // Headless render of `samples_per_pixel` samples per pixel into a PPM file. `world` is
+            // usually any hittable; a variant_scene also skips the virtual material calls, and a
+            // streamed_scene traces camera rays in batches. Returns false if the image can't be
+            // written.
+            initialize();
+
+            std::vector<color> image = trace_image(world, show_progress);
+            if (!write_image(image, image_width, image_height, filename)) {
+                return false;
+            }
+
+            if (record_cost) {
+                std::string stem = filename.substr(0, filename.rfind('.'));
+                cost.write(stem);
+            }
+            return true;
+        }
+
+        void render_sequence(bvh& world, const animation& anim, int frame_count, double frames_per_second,
+                             const std::string& filename_prefix) {
+            // Renders `frame_count` frames headlessly to `<filename_prefix>NNNN.ppm`. The world is
+            // refitted rather than rebuilt every frame, so animated objects should only move, not be
+            // added or removed. The scene update (evaluate, apply, refit) runs between frames, since
+            // tracing reads the objects and the BVH it changes. Writing frame n out overlaps with
+            // tracing frame n + 1 on another thread.
+            point3 base_lookfrom = lookfrom;
+            point3 base_lookat   = lookat;
+
+            std::future<void> encoding;
+
+            for (int frame = 0; frame < frame_count; frame++) {
+                auto frame_start = std::chrono::steady_clock::now();
+
+                animation::frame_state state = anim.evaluate(frame / frames_per_second, base_lookfrom, base_lookat);
+                anim.apply(state);
+                lookfrom = state.lookfrom;
+                lookat   = state.lookat;
+                world.refit();
+                initialize();
+
+                auto refit_end = std::chrono::steady_clock::now();
+
+                std::vector<color> image = trace_image(world, false);
+
+                auto trace_end = std::chrono::steady_clock::now();
+
+                // Only one frame is encoded at a time, so at most two images are alive at once.
+                if (encoding.valid()) {
+                    encoding.get();
+                }
+
+                std::string filename = filename_prefix + frame_number(frame) + ".ppm";
+                encoding = std::async(std::launch::async, [image = std::move(image), width = image_width, height = image_height, filename] {
+                    write_image(image, width, height, filename);
+                });
+
+                std::clog << "Frame " << frame + 1 << '/' << frame_count
+                          << ": update " << std::chrono::duration<double, std::milli>(refit_end - frame_start).count() << " ms"
+                          << ", trace " << std::chrono::duration<double, std::milli>(trace_end - refit_end).count() << " ms\n";
+            }
+
+            if (encoding.valid()) {
+                encoding.get();
+            }
+
+            lookfrom = base_lookfrom;
+            lookat   = base_lookat;
         }
 
     private:
@@ -106,32 +279,295 @@ class camera {
         vec3   u, v, w;              // Camera frame basis vectors
         vec3   defocus_disk_u;
         vec3   defocus_disk_v;
+        double pixel_spread;         // Angle subtended by one pixel, for ray cones
+        cost_map cost;
 
-        void updateSampleBuffer(const hittable& world, sf::Uint32* sample_buffer)
+        void updateSampleRow(const hittable& world, sf::Uint32* sample_buffer, int j)
         {
-            for (int j = 0; j < image_height; j++) {
-                for (int i = 0; i < image_width; i++) {
-                    ray r = get_ray(i, j);
-                    color pixel_color = ray_color(r, max_depth, world);
+            for (int i = 0; i < image_width; i++) {
+                color pixel_color = sample_pixel(world, i, j);
 
-                    static const interval intensity{ 0, 0.999 };
+                static const interval intensity{ 0, 0.999 };
 
-                    sample_buffer[4 * (j * image_width + i) + 0] += int(256 * intensity.clamp(linear_to_gamma(pixel_color.x())));
-                    sample_buffer[4 * (j * image_width + i) + 1] += int(256 * intensity.clamp(linear_to_gamma(pixel_color.y())));
-                    sample_buffer[4 * (j * image_width + i) + 2] += int(256 * intensity.clamp(linear_to_gamma(pixel_color.z())));
-                    sample_buffer[4 * (j * image_width + i) + 3] += 255;
+                sample_buffer[4 * (j * image_width + i) + 0] += int(256 * intensity.clamp(linear_to_gamma(pixel_color.x())));
+                sample_buffer[4 * (j * image_width + i) + 1] += int(256 * intensity.clamp(linear_to_gamma(pixel_color.y())));
+                sample_buffer[4 * (j * image_width + i) + 2] += int(256 * intensity.clamp(linear_to_gamma(pixel_color.z())));
+                sample_buffer[4 * (j * image_width + i) + 3] += 255;
+            }
+        }
+
+        long long updatePreviewRow(const hittable& world, sf::Uint8* pixels, sf::Uint32* sample_buffer, int stride, int block_j)
+        {
+            // Traces one sample per `stride` x `stride` block along one row of blocks and fills the
+            // whole block with it. Each sample also counts towards its own pixel in `sample_buffer`,
+            // so the full-resolution pass builds on the preview. Returns the number of pixels traced.
+            long long traced_pixels = 0;
+
+            for (int block_i = 0; block_i < image_width; block_i += stride) {
+                int i = std::min(block_i + stride / 2, image_width - 1);
+                int j = std::min(block_j + stride / 2, image_height - 1);
+
+                color pixel_color = sample_pixel(world, i, j);
+                traced_pixels += 1;
+
+                static const interval intensity{ 0, 0.999 };
+                sf::Uint8 rbyte = sf::Uint8(256 * intensity.clamp(linear_to_gamma(pixel_color.x())));
+                sf::Uint8 gbyte = sf::Uint8(256 * intensity.clamp(linear_to_gamma(pixel_color.y())));
+                sf::Uint8 bbyte = sf::Uint8(256 * intensity.clamp(linear_to_gamma(pixel_color.z())));
+
+                sample_buffer[4 * (j * image_width + i) + 0] += rbyte;
+                sample_buffer[4 * (j * image_width + i) + 1] += gbyte;
+                sample_buffer[4 * (j * image_width + i) + 2] += bbyte;
+                sample_buffer[4 * (j * image_width + i) + 3] += 255;
+
+                for (int y = block_j; y < std::min(block_j + stride, image_height); y++) {
+                    for (int x = block_i; x < std::min(block_i + stride, image_width); x++) {
+                        pixels[4 * (y * image_width + x) + 0] = rbyte;
+                        pixels[4 * (y * image_width + x) + 1] = gbyte;
+                        pixels[4 * (y * image_width + x) + 2] = bbyte;
+                        pixels[4 * (y * image_width + x) + 3] = 255;
+                    }
                 }
             }
+
+            return traced_pixels;
+        }
+
+        int budget_stride(double seconds_per_pixel) const {
+            // Smallest power-of-two stride whose reduced image fits in the frame budget.
+            if (seconds_per_pixel <= 0) {
+                return 1;
+            }
+
+            double budget_pixels = target_frame_time / seconds_per_pixel;
+            int stride = 1;
+            while (stride < image_width && double(image_width / stride) * (image_height / stride) > budget_pixels) {
+                stride *= 2;
+            }
+            return stride;
+        }
+
+        bool navigate(double frame_time) {
+            // Moves the camera with WASD (Q/E for down/up) and turns it with the arrow keys.
+            // Returns true if the view changed.
+            double step  = move_speed * frame_time;
+            double angle = 1.0 * frame_time;    // Radians per second
+            vec3   move;
+            vec3   forward = lookat - lookfrom;
+
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::W)) move += -w;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::S)) move +=  w;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::A)) move += -u;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::D)) move +=  u;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::Q)) move += -v;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::E)) move +=  v;
+
+            double yaw = 0;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left))  yaw += angle;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right)) yaw -= angle;
+
+            if (move.near_zero() && yaw == 0) {
+                return false;
+            }
+
+            if (yaw != 0) {
+                // Rotate the viewing direction around the up vector.
+                vec3 axis = unit_vector(vup);
+                forward = cos(yaw) * forward + sin(yaw) * cross(axis, forward)
+                        + (1 - cos(yaw)) * dot(axis, forward) * axis;
+            }
+
+            lookfrom += step * move;
+            lookat    = lookfrom + forward;
+            return true;
         }
 
         // Gamma correction from linear space to gamma 2 (whatever the hell that means)
-        inline double linear_to_gamma(double linear_component)
+        static double linear_to_gamma(double linear_component)
         {
             if (linear_component > 0)
                 return sqrt(linear_component);
             return 0;
         }
 
+        template <typename world_type>
+        color sample_pixel(const world_type& world, int i, int j) {
+            // Traces one camera sample through pixel i, j, recording its cost if requested.
+            if (!record_cost) {
+                return ray_color(get_ray(i, j), max_depth, world);
+            }
+
+            render_counters before = counters;
+            auto            start  = std::chrono::steady_clock::now();
+
+            color pixel_color = ray_color(get_ray(i, j), max_depth, world);
+
+            double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            cost.record(i, j, nanoseconds,
+                        counters.intersection_tests - before.intersection_tests,
+                        counters.rays - before.rays);
+            return pixel_color;
+        }
+
+        template <typename world_type>
+        std::vector<color> trace_image(const world_type& world, bool progress_bar) {
+            std::vector<color> image(image_width * image_height);
+
+            for (int j = 0; j < image_height; j++) {
+                if (progress_bar) {
+                    write_progress_bar(100 * j / image_height);
+                }
+
+                for (int i = 0; i < image_width; i++) {
+                    color pixel_color(0, 0, 0);
+                    for (int sample = 0; sample < samples_per_pixel; sample++) {
+                        pixel_color += sample_pixel(world, i, j);
+                    }
+                    image[j * image_width + i] = pixels_samples_scale * pixel_color;
+                }
+            }
+
+            if (progress_bar) {
+                write_progress_bar(100);
+            }
+
+            return image;
+        }
+
+        std::vector<color> trace_image(const streamed_scene& world, bool progress_bar) {
+            // Paths are traced a row at a time, one bounce of every path per `hit_batch`, so the
+            // clusters a bounce reaches are read once for all of the row's rays instead of stalling
+            // single rays. Only the environment's shadow rays use the blocking path. In the cost AOV,
+            // each path gets its own shading cost plus an even share of every batch it was in.
+            struct path {
+                ray       r;
+                color     throughput  = color(1, 1, 1);
+                color     radiance    = color(0, 0, 0);
+                double    scatter_pdf = 0;
+                double    nanoseconds = 0;
+                double    tests       = 0;
+                long long rays        = 0;
+            };
+
+            std::vector<color>      image(image_width * image_height);
+            std::vector<path>       paths(size_t(image_width) * samples_per_pixel);
+            std::vector<int>        active, still_active;
+            std::vector<ray>        rays;
+            std::vector<hit_record> records;
+            std::vector<char>       found;
+
+            for (int j = 0; j < image_height; j++) {
+                if (progress_bar) {
+                    write_progress_bar(100 * j / image_height);
+                }
+
+                active.clear();
+                for (int i = 0; i < image_width; i++) {
+                    for (int sample = 0; sample < samples_per_pixel; sample++) {
+                        size_t k = size_t(i) * samples_per_pixel + sample;
+                        paths[k] = path{ get_ray(i, j) };
+                        active.push_back(int(k));
+                    }
+                }
+
+                for (int depth = max_depth; depth > 0 && !active.empty(); depth--) {
+                    rays.clear();
+                    for (int k : active) {
+                        rays.push_back(paths[k].r);
+                    }
+                    render_counters batch_before = counters;
+                    auto            batch_start  = std::chrono::steady_clock::now();
+
+                    world.hit_batch(rays, interval(0.001, infinity), records, found);
+
+                    // The batch's own cost is shared evenly by its rays.
+                    double batch_nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - batch_start).count()
+                                             / active.size();
+                    double batch_tests       = double(counters.intersection_tests - batch_before.intersection_tests) / active.size();
+
+                    still_active.clear();
+                    for (size_t n = 0; n < active.size(); n++) {
+                        path&           p      = paths[active[n]];
+                        render_counters before = counters;
+                        auto            start  = std::chrono::steady_clock::now();
+
+                        counters.rays++;
+                        if (found[n]) {
+                            color  direct, attenuation;
+                            ray    scattered;
+                            double pdf;
+                            bool   bounces = shade_hit(p.r, records[n], world, direct, attenuation, scattered, pdf);
+
+                            p.radiance += p.throughput * direct;
+                            if (bounces && depth > 1) {
+                                p.throughput  = p.throughput * attenuation;
+                                p.r           = scattered;
+                                p.scatter_pdf = pdf;
+                                still_active.push_back(active[n]);
+                            }
+                        }
+                        else {
+                            p.radiance += p.throughput * shade_miss(p.r, p.scatter_pdf);
+                        }
+
+                        if (record_cost) {
+                            p.nanoseconds += batch_nanoseconds + std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+                            p.tests       += batch_tests + double(counters.intersection_tests - before.intersection_tests);
+                            p.rays        += counters.rays - before.rays;
+                        }
+                    }
+                    active.swap(still_active);
+                }
+
+                for (int i = 0; i < image_width; i++) {
+                    color pixel_color(0, 0, 0);
+                    for (int sample = 0; sample < samples_per_pixel; sample++) {
+                        const path& p = paths[size_t(i) * samples_per_pixel + sample];
+                        pixel_color += p.radiance;
+                        if (record_cost) {
+                            cost.record(i, j, p.nanoseconds, std::llround(p.tests), p.rays);
+                        }
+                    }
+                    image[j * image_width + i] = pixels_samples_scale * pixel_color;
+                }
+            }
+
+            if (progress_bar) {
+                write_progress_bar(100);
+            }
+
+            return image;
+        }
+
+        static bool write_image(const std::vector<color>& image, int width, int height, const std::string& filename) {
+            std::ofstream output_file(filename);
+            output_file << "P3\n" << width << ' ' << height << "\n255\n";
+
+            for (const color& pixel_color : image) {
+                write_color(output_file, color(linear_to_gamma(pixel_color.x()),
+                                               linear_to_gamma(pixel_color.y()),
+                                               linear_to_gamma(pixel_color.z())));
+            }
+
+            output_file.close();
+            return bool(output_file);
+        }
+
+        void write_pixels(const sf::Uint8* pixels, const std::string& filename) const {
+            // Writes the displayed (already gamma corrected) RGBA pixels as a PPM file.
+            std::ofstream output_file(filename);
+            output_file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+
+            for (int k = 0; k < image_width * image_height; k++) {
+                output_file << int(pixels[4 * k + 0]) << ' ' << int(pixels[4 * k + 1]) << ' ' << int(pixels[4 * k + 2]) << '\n';
+            }
+        }
+
+        static std::string frame_number(int frame) {
+            std::string number = std::to_string(frame);
+            return std::string(number.size() < 4 ? 4 - number.size() : 0, '0') + number;
+        }
+
         void clearSampleBuffer(sf::Uint32* sample_buffer) {
             for (int j = 0; j < image_height; j++) {
                 for (int i = 0; i < image_width; i++) {
@@ -143,9 +579,19 @@ class camera {
             }
         }
 
-        void updatePixels(sf::Uint8* pixels, const sf::Uint32* sample_buffer, int current_samples) {
-            for (int i = 0; i < 4 * image_width * image_height; i++) {
-                pixels[i] = sample_buffer[i] / current_samples;
+        void updatePixels(sf::Uint8* pixels, const sf::Uint32* sample_buffer) {
+            // The alpha channel accumulates 255 per sample, so it doubles as the per-pixel sample
+            // count. Pixels without samples yet keep whatever preview is already displayed.
+            for (int i = 0; i < image_width * image_height; i++) {
+                sf::Uint32 pixel_samples = sample_buffer[4 * i + 3] / 255;
+                if (pixel_samples == 0) {
+                    continue;
+                }
+
+                pixels[4 * i + 0] = sample_buffer[4 * i + 0] / pixel_samples;
+                pixels[4 * i + 1] = sample_buffer[4 * i + 1] / pixel_samples;
+                pixels[4 * i + 2] = sample_buffer[4 * i + 2] / pixel_samples;
+                pixels[4 * i + 3] = 255;
             }
         }
 
@@ -174,6 +620,7 @@ class camera {
             // Calculate the horizontal and vertical delta vectors from pixel to pixel.
             pixel_delta_u   = viewport_u / image_width;
             pixel_delta_v   = viewport_v / image_height;
+            pixel_spread    = pixel_delta_u.length() / focus_dist;
 
             // Calculate the location of the upper left pixel.
             point3 viewport_upper_left = camera_center
@@ -184,6 +631,10 @@ class camera {
             double defocus_radius   = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
             defocus_disk_u          = defocus_radius * u;
             defocus_disk_v          = defocus_radius * v;
+
+            if (record_cost) {
+                cost.resize(image_width, image_height);
+            }
         }
 
         ray get_ray(int i, int j) const {
@@ -198,7 +649,8 @@ class camera {
             point3 ray_origin    = (defocus_angle <= 0) ? camera_center : defocus_disk_sample();
             vec3   ray_direction = pixel_sample - ray_origin;
 
-            return ray(ray_origin, ray_direction); // !!!ray_direction is NOT normalized!!!
+            // The ray cone covers one pixel at the focus distance.
+            return ray(ray_origin, ray_direction, 0, pixel_spread); // !!!ray_direction is NOT normalized!!!
         }
 
         point3 defocus_disk_sample() const {
@@ -211,28 +663,119 @@ class camera {
             return vec3(random_double(-0.5, 0.5), random_double(-0.5, 0.5), 0);
         }
 
-        color ray_color(const ray& r, int depth, const hittable& world) const {
+        template <typename world_type>
+        color ray_color(const ray& r, int depth, const world_type& world, double scatter_pdf = 0) const {
+            // `scatter_pdf` is the solid angle density with which a diffuse bounce picked `r`, or 0
+            // if `r` was not picked by a diffuse bounce. It weights the environment radiance found
+            // by `r` against the direct environment samples taken at that bounce.
             if (depth <= 0) {
                 return color(0, 0, 0);
             }
 
+            counters.rays++;
+
             hit_record rec;
-            if (world.hit(r, interval(0.001, infinity), rec)) {
-                ray scattered;
-                color attenuation;
-                if (rec.mat->scatter(r, rec, attenuation, scattered)) {
-                    return attenuation * ray_color(scattered, depth - 1, world);
+            bool       hit = world.hit(r, interval(0.001, infinity), rec);
+            return shade(r, hit, rec, depth, world, scatter_pdf);
+        }
+
+        template <typename world_type>
+        color shade(const ray& r, bool hit, const hit_record& rec, int depth, const world_type& world, double scatter_pdf) const {
+            // The rest of `ray_color`, once the closest hit of `r` is known.
+            if (hit) {
+                color  direct, attenuation;
+                ray    scattered;
+                double pdf;
+                if (shade_hit(r, rec, world, direct, attenuation, scattered, pdf)) {
+                    return direct + attenuation * ray_color(scattered, depth - 1, world, pdf);
                 }
-                return color(0, 0, 0);
+                return direct;
             }
 
+            return shade_miss(r, scatter_pdf);
+        }
+
+        template <typename world_type>
+        bool shade_hit(const ray& r, const hit_record& rec, const world_type& world, color& direct, color& attenuation,
+                       ray& scattered, double& scatter_pdf) const {
+            // Light arriving directly at a hit, and the bounce to trace next. Returns false if the
+            // path ends here.
+            auto&& mat = material_at(world, rec);
+
+            direct = color(0, 0, 0);
+            color albedo;
+            bool  diffuse = background && mat.diffuse_albedo(rec, albedo);
+            if (diffuse) {
+                direct = sample_environment(rec, albedo, world);
+            }
+
+            if (!mat.scatter(r, rec, attenuation, scattered)) {
+                return false;
+            }
+
+            // The scattered ray's cone starts as wide as this one is at the hit.
+            scattered = ray(scattered.origin(), scattered.direction(),
+                            r.cone_width_at(rec.t), r.cone_spread() + mat.cone_spread());
+
+            scatter_pdf = diffuse ? cosine_pdf(rec.normal, scattered.direction()) : 0;
+            return true;
+        }
+
+        color shade_miss(const ray& r, double scatter_pdf) const {
+            // Light from the background along a ray that hit nothing.
             vec3 unit_direction = unit_vector(r.direction());
+
+            if (background) {
+                color radiance = background->eval(unit_direction);
+                if (scatter_pdf > 0) {
+                    radiance = power_heuristic(scatter_pdf, background->pdf(unit_direction)) * radiance;
+                }
+                return radiance;
+            }
+
             static vec3     gradient_direction  = unit_vector(vec3(1, 3, 0));
             static color    color_start         = color{ 1.0, 1.0, 1.0 };
             static color    color_finish        = color{ 0.5, 0.7, 1.0 };
             return skybox_gradient(unit_direction, gradient_direction, color_start, color_finish);
         }
 
+        template <typename world_type>
+        color sample_environment(const hit_record& rec, const color& albedo, const world_type& world) const {
+            // Next event estimation at a diffuse hit: one environment sample, importance sampled by
+            // radiance and combined with the diffuse bounce by multiple importance sampling.
+            vec3   direction;
+            double light_pdf;
+            color  radiance = background->sample(direction, light_pdf);
+
+            double cosine = dot(rec.normal, direction);
+            if (cosine <= 0 || light_pdf <= 0) {
+                return color(0, 0, 0);
+            }
+
+            if (world.occluded(ray(rec.p, direction), interval(0.001, infinity))) {
+                return color(0, 0, 0);
+            }
+
+            double weight = power_heuristic(light_pdf, cosine / pi);
+            return (weight * cosine / (pi * light_pdf)) * albedo * radiance;
+        }
+
+        static const material& material_at(const hittable& world, const hit_record& rec) {
+            return *rec.mat;
+        }
+
+        static variant_scene::material_ref material_at(const variant_scene& world, const hit_record& rec) {
+            return world.material_at(rec);
+        }
+
+        static double cosine_pdf(const vec3& normal, const vec3& direction) {
+            return fmax(0.0, dot(normal, unit_vector(direction))) / pi;
+        }
+
+        static double power_heuristic(double pdf, double other_pdf) {
+            return (pdf * pdf) / (pdf * pdf + other_pdf * other_pdf);
+        }
+
         color skybox_gradient(const vec3& unit_direction, const vec3& gradient_direction,
                               const color& color_start, const color& color_finish) const {
             double a = 0.5 * (dot(unit_direction, gradient_direction) + 1.0);
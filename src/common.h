@@ -28,8 +28,9 @@ inline double degrees_to_radians(double degrees) {
 }
 
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
+    // One generator per thread, so concurrent renders don't race on (or share) random state.
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    thread_local std::mt19937 generator;
     return distribution(generator);
 }
 
@@ -44,5 +45,6 @@ inline double random_double(double min, double max) {
 #include "interval.h"
 #include "ray.h"
 #include "vec3.h"
+#include "render_cost.h"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,421 @@
+#include "common.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "lru_cache.h"
+#include "scenes.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <csignal>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Long-running render server. It listens on a Unix socket for one job per connection, given as a
+// single line of key=value pairs, e.g.
+//
+//     scene=final width=400 spp=10 lookfrom=13,2,3 lookat=0,0,0 priority=5
+//
+// and answers `ok <image path>` or `error <reason>` once the image is written. Scenes and their
+// BVHs are built once and shared by every later job, jobs run highest priority first on a fixed
+// pool of threads, and identical jobs are rendered only once.
+
+struct render_job {
+    std::string scene             = "final";
+    int         image_width       = 400;
+    double      aspect_ratio      = 16.0 / 9.0;
+    int         samples_per_pixel = 10;
+    int         max_depth         = 50;
+    double      vfov              = 20;
+    point3      lookfrom          = point3(13, 2, 3);
+    point3      lookat            = point3(0, 0, 0);
+    vec3        vup               = vec3(0, 1, 0);
+    double      defocus_angle     = 0.6;
+    double      focus_dist        = 10;
+    int         priority          = 0;    // Higher runs first; not part of the job's identity
+
+    std::string key() const {
+        // Everything that affects the image, in a canonical form.
+        std::ostringstream out;
+        out.precision(17);
+        out << scene << ' ' << image_width << ' ' << aspect_ratio << ' ' << samples_per_pixel << ' '
+            << max_depth << ' ' << vfov << ' ' << lookfrom << ' ' << lookat << ' ' << vup << ' '
+            << defocus_angle << ' ' << focus_dist;
+        return out.str();
+    }
+};
+
+bool parse_vec3(std::string text, vec3& v) {
+    for (char& c : text) {
+        if (c == ',') c = ' ';
+    }
+    std::istringstream in(text);
+    return bool(in >> v[0] >> v[1] >> v[2]);
+}
+
+bool parse_job(const std::string& line, render_job& job, std::string& error) {
+    std::istringstream tokens(line);
+    std::string        token;
+
+    while (tokens >> token) {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos) {
+            error = "expected key=value, got '" + token + "'";
+            return false;
+        }
+
+        std::string key   = token.substr(0, equals);
+        std::string value = token.substr(equals + 1);
+        std::istringstream in(value);
+        bool ok = true;
+
+        if (key == "scene")         job.scene = value;
+        else if (key == "width")    ok = bool(in >> job.image_width) && job.image_width > 0;
+        else if (key == "aspect")   ok = bool(in >> job.aspect_ratio) && job.aspect_ratio > 0;
+        else if (key == "spp")      ok = bool(in >> job.samples_per_pixel) && job.samples_per_pixel > 0;
+        else if (key == "depth")    ok = bool(in >> job.max_depth);
+        else if (key == "vfov")     ok = bool(in >> job.vfov);
+        else if (key == "lookfrom") ok = parse_vec3(value, job.lookfrom);
+        else if (key == "lookat")   ok = parse_vec3(value, job.lookat);
+        else if (key == "vup")      ok = parse_vec3(value, job.vup);
+        else if (key == "defocus")  ok = bool(in >> job.defocus_angle);
+        else if (key == "focus")    ok = bool(in >> job.focus_dist);
+        else if (key == "priority") ok = bool(in >> job.priority);
+        else {
+            error = "unknown key '" + key + "'";
+            return false;
+        }
+
+        if (!ok) {
+            error = "bad value for '" + key + "'";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+class render_daemon {
+    public:
+        render_daemon(int thread_count) {
+            for (int i = 0; i < thread_count; i++) {
+                workers.emplace_back([this] { work(); });
+            }
+        }
+
+        ~render_daemon() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            queue_changed.notify_all();
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        std::shared_future<std::string> submit(const render_job& job) {
+            // Returns the reply for `job`. A job identical to one already queued, running or
+            // recently finished shares its result instead of being rendered again. If it is still
+            // queued, it is raised to the higher of the two priorities.
+            std::string key = job.key();
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto waiting = queued.find(key);
+            if (waiting != queued.end()) {
+                std::clog << "Joining queued identical job: " << key << '\n';
+
+                pending_job& pending = *waiting->second;
+                if (job.priority > pending.job.priority) {
+                    // The queue can't reorder an entry in place, so push a second one; whichever
+                    // is popped first runs the job and the other is skipped.
+                    pending.job.priority = job.priority;
+                    jobs.push(queued_job{ job.priority, pending.sequence, waiting->second });
+                }
+                if (!results.find(key)) {
+                    results.insert(key, make_shared<cached_reply>(pending.result), 1);
+                }
+                return pending.result;
+            }
+
+            shared_ptr<const cached_reply> cached = results.find(key);
+            if (cached) {
+                std::clog << "Reusing result for identical job: " << key << '\n';
+                return cached->reply;
+            }
+
+            auto pending = make_shared<pending_job>();
+            pending->job      = job;
+            pending->key      = key;
+            pending->sequence = next_sequence++;
+            pending->result   = pending->reply.get_future().share();
+            results.insert(key, make_shared<cached_reply>(pending->result), 1);
+            queued[key] = pending;
+
+            jobs.push(queued_job{ job.priority, pending->sequence, pending });
+            queue_changed.notify_one();
+            return pending->result;
+        }
+
+    private:
+        // Finished and in-flight replies kept for identical jobs; the oldest are dropped beyond this.
+        static const int max_cached_results = 1024;
+
+        struct pending_job {
+            render_job                        job;
+            std::string                       key;
+            long long                         sequence;
+            std::promise<std::string>         reply;
+            std::shared_future<std::string>   result;
+        };
+
+        struct queued_job {
+            int                       priority;
+            long long                 sequence;
+            shared_ptr<pending_job>   pending;
+
+            bool operator<(const queued_job& other) const {
+                // std::priority_queue pops the largest: highest priority, then oldest.
+                if (priority != other.priority) {
+                    return priority < other.priority;
+                }
+                return sequence > other.sequence;
+            }
+        };
+
+        struct cached_reply {
+            std::shared_future<std::string> reply;
+
+            cached_reply(const std::shared_future<std::string>& reply) : reply{ reply } {}
+
+            ~cached_reply() {
+                // Once a finished result drops out of the cache, its image goes too. A job still
+                // rendering keeps its image, since its client has yet to read it.
+                if (reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                    const std::string& text = reply.get();
+                    if (text.compare(0, 3, "ok ") == 0) {
+                        std::remove(text.c_str() + 3);
+                    }
+                }
+            }
+        };
+
+        std::mutex                                                   mutex;
+        std::condition_variable                                      queue_changed;
+        std::priority_queue<queued_job>                              jobs;
+        std::map<std::string, shared_ptr<pending_job>>               queued;    // Jobs not yet started, by key
+        lru_cache<std::string, cached_reply>                         results{ max_cached_results };
+        std::map<std::string, std::shared_future<shared_ptr<bvh>>>   scenes;
+        std::vector<std::thread>                                     workers;
+        long long                                                    next_sequence = 0;
+        bool                                                         stopping      = false;
+
+        void work() {
+            while (true) {
+                shared_ptr<pending_job> next;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    queue_changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+                    if (jobs.empty()) {
+                        return;
+                    }
+                    next = jobs.top().pending;
+                    jobs.pop();
+
+                    // A job raised in priority has a second entry; only the first one popped runs.
+                    auto waiting = queued.find(next->key);
+                    if (waiting == queued.end() || waiting->second != next) {
+                        continue;
+                    }
+                    queued.erase(waiting);
+                }
+
+                std::string reply = render(next->job);
+                if (reply.compare(0, 6, "error ") == 0) {
+                    // Don't keep failures, so the same job is tried again next time.
+                    results.erase(next->key);
+                }
+                next->reply.set_value(reply);
+            }
+        }
+
+        std::string render(const render_job& job) {
+            auto start = std::chrono::steady_clock::now();
+
+            shared_ptr<bvh> world = scene(job.scene);
+            if (!world) {
+                return "error unknown scene '" + job.scene + "'";
+            }
+
+            camera cam;
+            cam.aspect_ratio      = job.aspect_ratio;
+            cam.image_width       = job.image_width;
+            cam.samples_per_pixel = job.samples_per_pixel;
+            cam.max_depth         = job.max_depth;
+            cam.vfov              = job.vfov;
+            cam.lookfrom          = job.lookfrom;
+            cam.lookat            = job.lookat;
+            cam.vup               = job.vup;
+            cam.defocus_angle     = job.defocus_angle;
+            cam.focus_dist        = job.focus_dist;
+            cam.show_progress     = false;
+
+            std::ostringstream filename;
+            filename << "results/job_" << std::hex << std::hash<std::string>()(job.key()) << ".ppm";
+            if (!cam.render_to_file(*world, filename.str())) {
+                return "error cannot write " + filename.str();
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::clog << "Rendered " << filename.str() << " (priority " << job.priority << ") in " << seconds << " s\n";
+
+            return "ok " + filename.str();
+        }
+
+        shared_ptr<bvh> scene(const std::string& id) {
+            // Returns the cached BVH of a scene, building it on first use. Concurrent first uses
+            // wait for a single build. Returns null for unknown scene ids.
+            std::promise<shared_ptr<bvh>>       built;
+            std::shared_future<shared_ptr<bvh>> pending;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto cached = scenes.find(id);
+                if (cached != scenes.end()) {
+                    pending = cached->second;
+                }
+                else {
+                    scenes[id] = built.get_future().share();
+                }
+            }
+
+            if (pending.valid()) {
+                return pending.get();
+            }
+
+            // Build on a fresh thread so the random scenes come out the same as in the viewer,
+            // whose main thread also starts from an unused random generator.
+            shared_ptr<bvh> world;
+            std::thread([&] {
+                hittable_list list;
+                if (create_world(id, list)) {
+                    world = make_shared<bvh>(list);
+                }
+            }).join();
+
+            built.set_value(world);
+            return world;
+        }
+};
+
+void reply_and_close(int client, std::string reply) {
+    reply += '\n';
+    ssize_t written = write(client, reply.data(), reply.size());
+    (void)written;
+    close(client);
+}
+
+void handle_client(int client, render_daemon& daemon, std::atomic<int>& active_clients) {
+    // Jobs are short; anything longer than this is not a job line.
+    const size_t max_line_length = 4096;
+
+    std::string line;
+    char c;
+    while (line.size() <= max_line_length && read(client, &c, 1) == 1 && c != '\n') {
+        line += c;
+    }
+
+    render_job  job;
+    std::string error;
+    std::string reply = (line.size() > max_line_length) ? "error job line too long"
+                      : parse_job(line, job, error)     ? daemon.submit(job).get()
+                      : "error " + error;
+    reply_and_close(client, reply);
+    active_clients--;
+}
+
+int main(int argc, char* argv[]) {
+    // Optional flags:
+    //   --socket <path>  socket to listen on (default /tmp/raytracing.sock)
+    //   --threads <n>    number of render threads (default: one per hardware thread)
+    //   --clients <n>    connections served at once; more are turned away (default 256)
+    std::string socket_path  = "/tmp/raytracing.sock";
+    int         thread_count = int(std::thread::hardware_concurrency());
+    int         max_clients  = 256;
+    for (int i = 1; i + 1 < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket") {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--threads") {
+            thread_count = std::stoi(argv[++i]);
+        }
+        else if (arg == "--clients") {
+            max_clients = std::stoi(argv[++i]);
+        }
+    }
+    thread_count = (thread_count < 1) ? 1 : thread_count;
+
+    // A client that hangs up before its reply would otherwise kill the daemon with SIGPIPE; the
+    // failed write just returns an error instead.
+    signal(SIGPIPE, SIG_IGN);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (server < 0 || socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Cannot create socket " << socket_path << '\n';
+        return 1;
+    }
+    socket_path.copy(address.sun_path, socket_path.size());
+
+    unlink(socket_path.c_str());
+    if (bind(server, (sockaddr*)&address, sizeof(address)) < 0 || listen(server, 64) < 0) {
+        std::cerr << "Cannot listen on " << socket_path << '\n';
+        return 1;
+    }
+
+    std::clog << "Listening on " << socket_path << " with " << thread_count << " render threads\n";
+
+    render_daemon daemon(thread_count);
+
+    // Each connection waits on its own thread for its job, so the number of them is capped; a
+    // client beyond the cap, or one the system can't start a thread for, is told to retry later.
+    std::atomic<int> active_clients{ 0 };
+
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+
+        if (active_clients >= max_clients) {
+            reply_and_close(client, "error busy");
+            continue;
+        }
+
+        active_clients++;
+        try {
+            std::thread(handle_client, client, std::ref(daemon), std::ref(active_clients)).detach();
+        }
+        catch (const std::system_error&) {
+            active_clients--;
+            reply_and_close(client, "error busy");
+        }
+    }
+}
@@ -0,0 +1,384 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <vector>
+
+// A bounding volume hierarchy that supports inserting, removing and moving individual objects in
+// O(log n), for editing large scenes without rebuilding. Leaves store a "fat" box, the object's
+// bounds padded by `margin`, so small moves don't touch the tree at all. New leaves are placed by
+// a surface area cost descent, and every node on the path back to the root is improved with a local
+// rotation that lowers the surface area cost, which keeps traversal close to a fresh SAH build.
+class dynamic_bvh : public hittable {
+    public:
+        static const int null_node = -1;
+
+        double margin = 0.1;    // Padding added around each object's bounds, in world units
+
+        dynamic_bvh() {}
+
+        int insert(shared_ptr<hittable> object) {
+            // Adds an object and returns its proxy id, used to move or remove it later.
+            int leaf = allocate_node();
+            nodes[leaf].box    = fatten(object->bounding_box());
+            nodes[leaf].object = object;
+            nodes[leaf].height = 0;
+
+            insert_leaf(leaf);
+            return leaf;
+        }
+
+        void remove(int proxy) {
+            remove_leaf(proxy);
+            free_node(proxy);
+        }
+
+        bool move(int proxy) {
+            // Call after the object behind `proxy` has changed its bounds. Returns true if the
+            // object left its fat box and had to be reinserted.
+            aabb box = nodes[proxy].object->bounding_box();
+            if (contains(nodes[proxy].box, box)) {
+                return false;
+            }
+
+            remove_leaf(proxy);
+            nodes[proxy].box = fatten(box);
+            insert_leaf(proxy);
+            return true;
+        }
+
+        const shared_ptr<hittable>& object(int proxy) const { return nodes[proxy].object; }
+
+        int size() const { return leaf_count; }
+
+        int height() const {
+            return (root == null_node) ? 0 : nodes[root].height;
+        }
+
+        double area_ratio() const {
+            // Sum of all node areas over the root area; lower means cheaper traversal.
+            if (root == null_node) {
+                return 0;
+            }
+
+            double total_area = 0;
+            for (const node& n : nodes) {
+                if (n.height >= 0) {
+                    total_area += n.box.surface_area();
+                }
+            }
+            return total_area / nodes[root].box.surface_area();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (root == null_node) {
+                return false;
+            }
+
+            bool hit_anything = false;
+            int  local_stack[max_stack];
+            std::vector<int> deep_stack;
+            int* stack      = traversal_stack(local_stack, deep_stack);
+            int  stack_size = 0;
+            stack[stack_size++] = root;
+
+            while (stack_size > 0) {
+                const node& n = nodes[stack[--stack_size]];
+                if (!n.box.hit(r, ray_t)) {
+                    continue;
+                }
+
+                if (n.is_leaf()) {
+                    if (n.object->hit(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                    continue;
+                }
+
+                // Visit the child whose center is nearer along the ray first.
+                int near_child = n.child1;
+                int far_child  = n.child2;
+                if (dot(nodes[far_child].box.centroid() - nodes[near_child].box.centroid(), r.direction()) < 0) {
+                    std::swap(near_child, far_child);
+                }
+                stack[stack_size++] = far_child;
+                stack[stack_size++] = near_child;
+            }
+
+            return hit_anything;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            if (root == null_node) {
+                return false;
+            }
+
+            int  local_stack[max_stack];
+            std::vector<int> deep_stack;
+            int* stack      = traversal_stack(local_stack, deep_stack);
+            int  stack_size = 0;
+            stack[stack_size++] = root;
+
+            while (stack_size > 0) {
+                const node& n = nodes[stack[--stack_size]];
+                if (!n.box.hit(r, ray_t)) {
+                    continue;
+                }
+
+                if (n.is_leaf()) {
+                    if (n.object->occluded(r, ray_t)) {
+                        return true;
+                    }
+                    continue;
+                }
+
+                stack[stack_size++] = n.child2;
+                stack[stack_size++] = n.child1;
+            }
+
+            return false;
+        }
+
+        aabb bounding_box() const override {
+            return (root == null_node) ? aabb() : nodes[root].box;
+        }
+
+    private:
+        struct node {
+            aabb                 box;
+            shared_ptr<hittable> object;    // Only set for leaves
+            int                  parent = null_node;   // Next free node while on the free list
+            int                  child1 = null_node;
+            int                  child2 = null_node;
+            int                  height = -1;          // 0 for leaves, -1 for free nodes
+
+            bool is_leaf() const { return child1 == null_node; }
+        };
+
+        // A depth-first traversal never holds more than height + 1 nodes on its stack. Trees
+        // deeper than this fixed stack fall back to a heap allocated one.
+        static const int max_stack = 64;
+
+        std::vector<node> nodes;
+        int               root       = null_node;
+        int               free_list  = null_node;
+        int               leaf_count = 0;
+
+        int* traversal_stack(int* local_stack, std::vector<int>& deep_stack) const {
+            if (height() < max_stack) {
+                return local_stack;
+            }
+            deep_stack.resize(height() + 1);
+            return deep_stack.data();
+        }
+
+        aabb fatten(const aabb& box) const {
+            return aabb(box.x.expand(2 * margin), box.y.expand(2 * margin), box.z.expand(2 * margin));
+        }
+
+        static bool contains(const aabb& outer, const aabb& inner) {
+            return outer.x.min <= inner.x.min && inner.x.max <= outer.x.max
+                && outer.y.min <= inner.y.min && inner.y.max <= outer.y.max
+                && outer.z.min <= inner.z.min && inner.z.max <= outer.z.max;
+        }
+
+        int allocate_node() {
+            if (free_list == null_node) {
+                nodes.push_back(node());
+                return int(nodes.size()) - 1;
+            }
+
+            int index = free_list;
+            free_list = nodes[index].parent;
+            nodes[index] = node();
+            return index;
+        }
+
+        void free_node(int index) {
+            nodes[index] = node();
+            nodes[index].parent = free_list;
+            free_list = index;
+        }
+
+        void insert_leaf(int leaf) {
+            leaf_count++;
+
+            if (root == null_node) {
+                root = leaf;
+                nodes[root].parent = null_node;
+                return;
+            }
+
+            // Descend towards the cheapest sibling. Creating a new parent at `index` costs the area
+            // of the combined box, and every ancestor grows by the area it inherits from the leaf.
+            aabb leaf_box = nodes[leaf].box;    // A copy, since allocating the new parent may grow `nodes`
+            int index = root;
+            while (!nodes[index].is_leaf()) {
+                int child1 = nodes[index].child1;
+                int child2 = nodes[index].child2;
+
+                double area          = nodes[index].box.surface_area();
+                double combined_area = aabb(nodes[index].box, leaf_box).surface_area();
+
+                double cost             = 2 * combined_area;
+                double inheritance_cost = 2 * (combined_area - area);
+
+                double cost1 = descend_cost(child1, leaf_box) + inheritance_cost;
+                double cost2 = descend_cost(child2, leaf_box) + inheritance_cost;
+
+                if (cost < cost1 && cost < cost2) {
+                    break;
+                }
+
+                index = (cost1 < cost2) ? child1 : child2;
+            }
+
+            int sibling    = index;
+            int old_parent = nodes[sibling].parent;
+            int new_parent = allocate_node();
+            nodes[new_parent].parent = old_parent;
+            nodes[new_parent].box    = aabb(leaf_box, nodes[sibling].box);
+            nodes[new_parent].height = nodes[sibling].height + 1;
+            nodes[new_parent].child1 = sibling;
+            nodes[new_parent].child2 = leaf;
+            nodes[sibling].parent    = new_parent;
+            nodes[leaf].parent       = new_parent;
+
+            if (old_parent == null_node) {
+                root = new_parent;
+            }
+            else if (nodes[old_parent].child1 == sibling) {
+                nodes[old_parent].child1 = new_parent;
+            }
+            else {
+                nodes[old_parent].child2 = new_parent;
+            }
+
+            refit_ancestors(nodes[leaf].parent);
+        }
+
+        double descend_cost(int child, const aabb& leaf_box) const {
+            // Lower bound on the cost of placing the leaf somewhere under `child`.
+            double combined_area = aabb(leaf_box, nodes[child].box).surface_area();
+            if (nodes[child].is_leaf()) {
+                return combined_area;
+            }
+            return combined_area - nodes[child].box.surface_area();
+        }
+
+        void remove_leaf(int leaf) {
+            leaf_count--;
+
+            if (leaf == root) {
+                root = null_node;
+                return;
+            }
+
+            int parent       = nodes[leaf].parent;
+            int grand_parent = nodes[parent].parent;
+            int sibling      = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+            // Replace the parent by the sibling.
+            if (grand_parent == null_node) {
+                root = sibling;
+                nodes[sibling].parent = null_node;
+            }
+            else {
+                if (nodes[grand_parent].child1 == parent) {
+                    nodes[grand_parent].child1 = sibling;
+                }
+                else {
+                    nodes[grand_parent].child2 = sibling;
+                }
+                nodes[sibling].parent = grand_parent;
+                refit_ancestors(grand_parent);
+            }
+
+            free_node(parent);
+            nodes[leaf].parent = null_node;
+        }
+
+        void refit_ancestors(int index) {
+            // Walks back to the root, rotating and recomputing bounds and heights on the way.
+            while (index != null_node) {
+                rotate(index);
+                refresh(index);
+
+                index = nodes[index].parent;
+            }
+        }
+
+        void refresh(int index) {
+            int child1 = nodes[index].child1;
+            int child2 = nodes[index].child2;
+            nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+            nodes[index].box    = aabb(nodes[child1].box, nodes[child2].box);
+        }
+
+        void swap_subtrees(int x, int y) {
+            // Exchanges the positions of two subtrees, neither of which contains the other.
+            int parent_x = nodes[x].parent;
+            int parent_y = nodes[y].parent;
+
+            if (nodes[parent_x].child1 == x) nodes[parent_x].child1 = y; else nodes[parent_x].child2 = y;
+            if (nodes[parent_y].child1 == y) nodes[parent_y].child1 = x; else nodes[parent_y].child2 = x;
+
+            nodes[x].parent = parent_y;
+            nodes[y].parent = parent_x;
+        }
+
+        void rotate(int a) {
+            // Tries swapping a child of `a` with a grandchild, or two grandchildren, and applies
+            // the swap that shrinks the summed area of the children of `a` the most. The bounds
+            // of `a` itself don't change, so neither do those of its ancestors.
+            int b = nodes[a].child1;
+            int c = nodes[a].child2;
+            if (nodes[b].is_leaf() && nodes[c].is_leaf()) {
+                return;
+            }
+
+            double area_b = nodes[b].box.surface_area();
+            double area_c = nodes[c].box.surface_area();
+
+            enum { none, swap_b_f, swap_b_g, swap_c_d, swap_c_e, swap_d_f, swap_d_g } best = none;
+            double best_cost = area_b + area_c;
+
+            int d = nodes[b].child1, e = nodes[b].child2;
+            int f = nodes[c].child1, g = nodes[c].child2;
+
+            auto consider = [&](double cost, decltype(best) rotation) {
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best      = rotation;
+                }
+            };
+
+            if (!nodes[c].is_leaf()) {
+                consider(area_b + aabb(nodes[b].box, nodes[g].box).surface_area(), swap_b_f);
+                consider(area_b + aabb(nodes[b].box, nodes[f].box).surface_area(), swap_b_g);
+            }
+            if (!nodes[b].is_leaf()) {
+                consider(area_c + aabb(nodes[c].box, nodes[e].box).surface_area(), swap_c_d);
+                consider(area_c + aabb(nodes[c].box, nodes[d].box).surface_area(), swap_c_e);
+            }
+            if (!nodes[b].is_leaf() && !nodes[c].is_leaf()) {
+                consider(aabb(nodes[f].box, nodes[e].box).surface_area() + aabb(nodes[d].box, nodes[g].box).surface_area(), swap_d_f);
+                consider(aabb(nodes[g].box, nodes[e].box).surface_area() + aabb(nodes[f].box, nodes[d].box).surface_area(), swap_d_g);
+            }
+
+            switch (best) {
+                case none:     return;
+                case swap_b_f: swap_subtrees(b, f); refresh(c); break;
+                case swap_b_g: swap_subtrees(b, g); refresh(c); break;
+                case swap_c_d: swap_subtrees(c, d); refresh(b); break;
+                case swap_c_e: swap_subtrees(c, e); refresh(b); break;
+                case swap_d_f: swap_subtrees(d, f); refresh(b); refresh(c); break;
+                case swap_d_g: swap_subtrees(d, g); refresh(b); refresh(c); break;
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Equirectangular HDR environment map, used as the background and as a light. Directions map to
+// the image with +y at the top row and the longitude measured around the y axis. For importance
+// sampling, every texel gets a probability proportional to its luminance times the solid angle it
+// covers, stored in an alias table so a sample costs O(1).
+class environment {
+    public:
+        double intensity = 1.0;    // Scale applied to every radiance value
+
+        bool load(const std::string& filename) {
+            // Loads a Radiance .hdr (RGBE) or a .pfm file. Returns false if the file can't be read.
+            std::ifstream file(filename, std::ios::binary);
+            if (!file) {
+                return false;
+            }
+
+            bool loaded = (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pfm") == 0)
+                        ? load_pfm(file)
+                        : load_hdr(file);
+            if (!loaded || width <= 0 || height <= 0) {
+                return false;
+            }
+
+            build_alias_table();
+            return true;
+        }
+
+        color eval(const vec3& unit_direction) const {
+            // Radiance arriving from `unit_direction`. A nearest texel lookup, so it is cheap enough
+            // for every escaping ray.
+            return intensity * texel(texel_index(unit_direction));
+        }
+
+        double pdf(const vec3& unit_direction) const {
+            // Solid angle density with which `sample` picks `unit_direction`.
+            double sin_theta = sqrt(fmax(0.0, 1 - unit_direction.y() * unit_direction.y()));
+            if (sin_theta <= 0) {
+                return 0;
+            }
+            return probability[texel_index(unit_direction)] / (texel_solid_angle * sin_theta);
+        }
+
+        color sample(vec3& unit_direction, double& sample_pdf) const {
+            // Picks a direction with probability proportional to the radiance coming from it, and
+            // returns that radiance. Picks a texel from the alias table, then a point inside it.
+            int    column_count = int(probability.size());
+            double x            = random_double() * column_count;
+            int    index        = std::min(int(x), column_count - 1);
+            if (x - index >= alias_probability[index]) {
+                index = alias[index];
+            }
+
+            double u = (index % width + random_double()) / width;
+            double v = (index / width + random_double()) / height;
+
+            double phi       = 2 * pi * u;
+            double theta     = pi * v;
+            double sin_theta = sin(theta);
+            unit_direction   = vec3(-sin_theta * cos(phi), cos(theta), -sin_theta * sin(phi));
+
+            sample_pdf = (sin_theta > 0) ? probability[index] / (texel_solid_angle * sin_theta) : 0;
+            return intensity * texel(index);
+        }
+
+    private:
+        int                 width             = 0;
+        int                 height            = 0;
+        std::vector<float>  pixels;                 // RGB, row-major, top row first
+        std::vector<double> probability;            // Chance of sampling each texel
+        std::vector<double> alias_probability;      // Chance of keeping a texel rather than its alias
+        std::vector<int>    alias;
+        double              texel_solid_angle = 0;  // Texel area in (phi, theta), before the sin(theta) factor
+
+        color texel(int index) const {
+            return color(pixels[3 * index + 0], pixels[3 * index + 1], pixels[3 * index + 2]);
+        }
+
+        int texel_index(const vec3& unit_direction) const {
+            double u = (atan2(unit_direction.z(), unit_direction.x()) + pi) / (2 * pi);
+            double v = acos(std::clamp(unit_direction.y(), -1.0, 1.0)) / pi;
+            int i = std::min(int(u * width), width - 1);
+            int j = std::min(int(v * height), height - 1);
+            return j * width + i;
+        }
+
+        void build_alias_table() {
+            // Vose's alias method over texel weights of luminance * sin(theta).
+            int count = width * height;
+            texel_solid_angle = (2 * pi / width) * (pi / height);
+
+            std::vector<double> weights(count);
+            double total = 0;
+            for (int j = 0; j < height; j++) {
+                double sin_theta = sin(pi * (j + 0.5) / height);
+                for (int i = 0; i < width; i++) {
+                    color c = texel(j * width + i);
+                    double luminance = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+                    weights[j * width + i] = fmax(0.0, luminance) * sin_theta;
+                    total += weights[j * width + i];
+                }
+            }
+
+            probability.assign(count, 1.0 / count);
+            if (total > 0) {
+                for (int k = 0; k < count; k++) {
+                    probability[k] = weights[k] / total;
+                }
+            }
+
+            alias_probability.assign(count, 1.0);
+            alias.assign(count, 0);
+
+            std::vector<int>    small, large;
+            std::vector<double> scaled(count);
+            for (int k = 0; k < count; k++) {
+                scaled[k] = probability[k] * count;
+                (scaled[k] < 1 ? small : large).push_back(k);
+            }
+
+            while (!small.empty() && !large.empty()) {
+                int less = small.back(); small.pop_back();
+                int more = large.back(); large.pop_back();
+
+                alias_probability[less] = scaled[less];
+                alias[less]             = more;
+
+                scaled[more] = (scaled[more] + scaled[less]) - 1;
+                (scaled[more] < 1 ? small : large).push_back(more);
+            }
+
+            // Whatever is left is 1 up to rounding error.
+            for (int k : small) alias_probability[k] = 1.0;
+            for (int k : large) alias_probability[k] = 1.0;
+        }
+
+        bool load_pfm(std::ifstream& file) {
+            std::string format;
+            double      scale;
+            file >> format >> width >> height >> scale;
+            file.get();   // Single whitespace byte before the data
+
+            int channels = (format == "PF") ? 3 : (format == "Pf") ? 1 : 0;
+            if (!file || channels == 0 || width <= 0 || height <= 0) {
+                return false;
+            }
+
+            std::vector<float> data(size_t(width) * height * channels);
+            file.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+            if (!file) {
+                return false;
+            }
+
+            // A negative scale means little-endian data; PFM rows are stored bottom to top.
+            bool swap_bytes = (scale < 0) != is_little_endian();
+            pixels.resize(size_t(width) * height * 3);
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    for (int c = 0; c < 3; c++) {
+                        float value = data[(size_t(height - 1 - j) * width + i) * channels + (channels == 3 ? c : 0)];
+                        if (swap_bytes) {
+                            value = byte_swap(value);
+                        }
+                        pixels[(size_t(j) * width + i) * 3 + c] = value;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool load_hdr(std::ifstream& file) {
+            // Header lines up to an empty line, then the "-Y <height> +X <width>" resolution line.
+            std::string line;
+            if (!std::getline(file, line) || line.rfind("#?", 0) != 0) {
+                return false;
+            }
+            while (std::getline(file, line) && !line.empty()) {
+                if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+                    return false;
+                }
+            }
+
+            std::string y_axis, x_axis;
+            file >> y_axis >> height >> x_axis >> width;
+            file.get();
+            if (!file || y_axis != "-Y" || x_axis != "+X") {
+                return false;
+            }
+
+            pixels.resize(size_t(width) * height * 3);
+            std::vector<uint8_t> scanline(size_t(width) * 4);
+
+            for (int j = 0; j < height; j++) {
+                if (!read_hdr_scanline(file, scanline)) {
+                    return false;
+                }
+
+                for (int i = 0; i < width; i++) {
+                    const uint8_t* rgbe = &scanline[size_t(i) * 4];
+                    double factor = (rgbe[3] == 0) ? 0 : ldexp(1.0, rgbe[3] - (128 + 8));
+                    for (int c = 0; c < 3; c++) {
+                        pixels[(size_t(j) * width + i) * 3 + c] = float((rgbe[c] + 0.5) * factor);
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool read_hdr_scanline(std::ifstream& file, std::vector<uint8_t>& scanline) const {
+            uint8_t start[4];
+            if (!file.read(reinterpret_cast<char*>(start), 4)) {
+                return false;
+            }
+
+            bool run_length_encoded = start[0] == 2 && start[1] == 2 && (start[2] & 0x80) == 0
+                                   && width >= 8 && width < 32768;
+            if (!run_length_encoded) {
+                // Flat RGBE pixels.
+                std::copy(start, start + 4, scanline.begin());
+                return bool(file.read(reinterpret_cast<char*>(&scanline[4]), scanline.size() - 4));
+            }
+
+            if (((start[2] << 8) | start[3]) != width) {
+                return false;
+            }
+
+            // Each of the four channels is run-length encoded separately.
+            for (int c = 0; c < 4; c++) {
+                int i = 0;
+                while (i < width) {
+                    int count = file.get();
+                    if (count == EOF) {
+                        return false;
+                    }
+
+                    if (count > 128) {
+                        count -= 128;
+                        int value = file.get();
+                        if (value == EOF || i + count > width) {
+                            return false;
+                        }
+                        for (int k = 0; k < count; k++) {
+                            scanline[size_t(i++) * 4 + c] = uint8_t(value);
+                        }
+                    }
+                    else {
+                        if (count == 0 || i + count > width) {
+                            return false;
+                        }
+                        for (int k = 0; k < count; k++) {
+                            scanline[size_t(i++) * 4 + c] = uint8_t(file.get());
+                        }
+                    }
+                }
+            }
+            return bool(file);
+        }
+
+        static bool is_little_endian() {
+            uint16_t one = 1;
+            return *reinterpret_cast<uint8_t*>(&one) == 1;
+        }
+
+        static float byte_swap(float value) {
+            uint8_t* bytes = reinterpret_cast<uint8_t*>(&value);
+            std::swap(bytes[0], bytes[3]);
+            std::swap(bytes[1], bytes[2]);
+            return value;
+        }
+};
+
+#endif
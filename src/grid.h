@@ -0,0 +1,310 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <vector>
+
+// Uniform grid over a scene's objects, traversed cell by cell along the ray with a 3D-DDA. Suits
+// scenes of many similar-sized objects spread fairly evenly, like the random sphere field, where
+// it is quick to build and finds the first cells with a hit without walking down a hierarchy.
+//
+// The resolution is picked automatically, aiming for a few objects per cell. Objects much larger
+// than the typical object (e.g. a ground sphere) would stretch the grid over empty space, so they
+// are kept out of it and tested against every ray instead.
+class grid : public hittable {
+    public:
+        grid(const hittable_list& list) : objects{ list.objects } {
+            build();
+        }
+
+        grid(const std::vector<shared_ptr<hittable>>& objects) : objects{ objects } {
+            build();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            bool hit_anything = false;
+
+            for (int i : large_objects) {
+                if (objects[i]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+
+            // Objects spanning several cells are tested once per ray. A small direct-mapped mailbox
+            // of the objects tested most recently catches nearly all repeats; a miss only costs a
+            // redundant test.
+            int mailbox[mailbox_size];
+            std::fill(mailbox, mailbox + mailbox_size, -1);
+
+            walk(r, ray_t, [&](int cell, double cell_exit) {
+                for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+                    int object = cell_objects[k];
+                    int& slot  = mailbox[object & (mailbox_size - 1)];
+                    if (slot == object) {
+                        continue;
+                    }
+                    slot = object;
+
+                    if (objects[object]->hit(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+
+                // A hit inside this cell can't be beaten by anything in the cells further along.
+                // A hit beyond it came from an object that reaches into later cells, so keep going.
+                return ray_t.max <= cell_exit;
+            });
+
+            return hit_anything;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            for (int i : large_objects) {
+                if (objects[i]->occluded(r, ray_t)) {
+                    return true;
+                }
+            }
+
+            int mailbox[mailbox_size];
+            std::fill(mailbox, mailbox + mailbox_size, -1);
+
+            bool blocked = false;
+            walk(r, ray_t, [&](int cell, double cell_exit) {
+                for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+                    int object = cell_objects[k];
+                    int& slot  = mailbox[object & (mailbox_size - 1)];
+                    if (slot == object) {
+                        continue;
+                    }
+                    slot = object;
+
+                    if (objects[object]->occluded(r, ray_t)) {
+                        blocked = true;
+                        return true;
+                    }
+                }
+                return false;
+            });
+
+            return blocked;
+        }
+
+        aabb bounding_box() const override {
+            return bbox;
+        }
+
+        int resolution(int axis) const { return cells[axis]; }
+        size_t cell_count() const { return size_t(cells[0]) * cells[1] * cells[2]; }
+        size_t large_object_count() const { return large_objects.size(); }
+
+    private:
+        static constexpr int    mailbox_size   = 16;    // Power of two
+        static constexpr int    max_resolution = 256;   // Cells per axis
+        static constexpr double cell_density   = 2.0;   // Target cells per object
+        static constexpr double large_factor   = 8.0;   // Objects wider than this many median widths stay out of the grid
+
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<int>                  large_objects;
+        std::vector<int>                  cell_start;     // Objects of cell c are cell_objects[cell_start[c] .. cell_start[c + 1])
+        std::vector<int>                  cell_objects;
+        aabb                              bbox;           // Of every object
+        aabb                              grid_bounds;    // Of the objects in the grid
+        int                               cells[3] = { 1, 1, 1 };
+        vec3                              cell_size;
+
+        void build() {
+            std::vector<aabb> boxes(objects.size());
+            for (size_t i = 0; i < objects.size(); i++) {
+                boxes[i] = objects[i]->bounding_box();
+                bbox     = aabb(bbox, boxes[i]);
+            }
+
+            // Split off the objects far wider than the median.
+            std::vector<double> widths(boxes.size());
+            for (size_t i = 0; i < boxes.size(); i++) {
+                widths[i] = width(boxes[i]);
+            }
+            std::vector<double> sorted_widths = widths;
+            std::nth_element(sorted_widths.begin(), sorted_widths.begin() + sorted_widths.size() / 2, sorted_widths.end());
+            double median_width = sorted_widths.empty() ? 0 : sorted_widths[sorted_widths.size() / 2];
+
+            std::vector<int> grid_objects;
+            for (size_t i = 0; i < boxes.size(); i++) {
+                if (widths[i] > large_factor * median_width) {
+                    large_objects.push_back(int(i));
+                }
+                else {
+                    grid_objects.push_back(int(i));
+                    grid_bounds = aabb(grid_bounds, boxes[i]);
+                }
+            }
+
+            if (grid_objects.empty()) {
+                cell_start.assign(2, 0);
+                return;
+            }
+
+            // Cleary and Wyvill: choose cubic-ish cells so the grid has about `cell_density` cells
+            // per object. An axis thinner than one such cell, as in a flat or thin scene, gets a
+            // single cell, and the cells are sized over the remaining axes instead, so that the
+            // cell count still follows the object count.
+            bool thin[3] = { false, false, false };
+            double scale = 0;
+            for (bool changed = true; changed; ) {
+                changed = false;
+
+                double measure = 1;     // Volume, area or length spanned by the axes not yet thin
+                int    spanned = 0;
+                for (int axis = 0; axis < 3; axis++) {
+                    if (!thin[axis]) {
+                        measure *= grid_bounds.axis_interval(axis).size();
+                        spanned++;
+                    }
+                }
+                if (spanned == 0) {
+                    break;
+                }
+                scale = std::pow(cell_density * grid_objects.size() / measure, 1.0 / spanned);
+
+                for (int axis = 0; axis < 3; axis++) {
+                    if (!thin[axis] && !(grid_bounds.axis_interval(axis).size() * scale >= 1)) {
+                        thin[axis] = true;
+                        changed    = true;
+                    }
+                }
+            }
+
+            for (int axis = 0; axis < 3; axis++) {
+                double extent   = grid_bounds.axis_interval(axis).size();
+                cells[axis]     = thin[axis] ? 1 : std::clamp(int(std::round(extent * scale)), 1, max_resolution);
+                cell_size[axis] = extent / cells[axis];
+            }
+
+            // Counting sort of (cell, object) pairs: count the objects per cell, then place them.
+            cell_start.assign(cell_count() + 1, 0);
+            for_each_cell(grid_objects, boxes, [&](int cell, int object) {
+                cell_start[cell + 1]++;
+            });
+            for (size_t c = 1; c < cell_start.size(); c++) {
+                cell_start[c] += cell_start[c - 1];
+            }
+
+            cell_objects.resize(cell_start.back());
+            std::vector<int> next(cell_start.begin(), cell_start.end() - 1);
+            for_each_cell(grid_objects, boxes, [&](int cell, int object) {
+                cell_objects[next[cell]++] = object;
+            });
+        }
+
+        template <typename visit_pair>
+        void for_each_cell(const std::vector<int>& grid_objects, const std::vector<aabb>& boxes, visit_pair&& visit) const {
+            // Calls `visit(cell, object)` for every cell each object's bounds overlap.
+            for (int i : grid_objects) {
+                int low[3], high[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    low[axis]  = cell_coordinate(axis, boxes[i].axis_interval(axis).min);
+                    high[axis] = cell_coordinate(axis, boxes[i].axis_interval(axis).max);
+                }
+
+                for (int z = low[2]; z <= high[2]; z++) {
+                    for (int y = low[1]; y <= high[1]; y++) {
+                        for (int x = low[0]; x <= high[0]; x++) {
+                            visit(cell_index(x, y, z), i);
+                        }
+                    }
+                }
+            }
+        }
+
+        static double width(const aabb& box) {
+            return std::max({ box.x.size(), box.y.size(), box.z.size() });
+        }
+
+        int cell_coordinate(int axis, double position) const {
+            int c = int((position - grid_bounds.axis_interval(axis).min) / cell_size[axis]);
+            return std::clamp(c, 0, cells[axis] - 1);
+        }
+
+        int cell_index(int x, int y, int z) const {
+            return (z * cells[1] + y) * cells[0] + x;
+        }
+
+        template <typename visit_cell>
+        void walk(const ray& r, const interval& ray_t, visit_cell&& visit) const {
+            // Amanatides and Woo's 3D-DDA: calls `visit(cell, exit_t)` for each non-empty cell the
+            // ray passes through within `ray_t`, in order, until `visit` returns true. `ray_t` is
+            // re-read after every cell, so a closer hit ends the walk early.
+            if (cell_objects.empty()) {
+                return;
+            }
+
+            const point3& origin    = r.origin();
+            const vec3&   direction = r.direction();
+
+            // Clip the ray to the grid bounds.
+            double t_enter = ray_t.min;
+            double t_leave = ray_t.max;
+            for (int axis = 0; axis < 3; axis++) {
+                const interval& ax  = grid_bounds.axis_interval(axis);
+                double          inv = 1.0 / direction[axis];
+                double          t0  = (ax.min - origin[axis]) * inv;
+                double          t1  = (ax.max - origin[axis]) * inv;
+                if (t0 > t1) std::swap(t0, t1);
+                t_enter = std::max(t_enter, t0);
+                t_leave = std::min(t_leave, t1);
+            }
+            if (!(t_enter <= t_leave)) {
+                return;
+            }
+
+            int    cell[3], step[3];
+            double t_next[3], t_delta[3];
+            point3 entry = r.at(t_enter);
+            for (int axis = 0; axis < 3; axis++) {
+                cell[axis] = cell_coordinate(axis, entry[axis]);
+
+                if (direction[axis] > 0) {
+                    step[axis]    = 1;
+                    t_next[axis]  = (grid_bounds.axis_interval(axis).min + (cell[axis] + 1) * cell_size[axis] - origin[axis]) / direction[axis];
+                    t_delta[axis] = cell_size[axis] / direction[axis];
+                }
+                else if (direction[axis] < 0) {
+                    step[axis]    = -1;
+                    t_next[axis]  = (grid_bounds.axis_interval(axis).min + cell[axis] * cell_size[axis] - origin[axis]) / direction[axis];
+                    t_delta[axis] = -cell_size[axis] / direction[axis];
+                }
+                else {
+                    step[axis]    = 0;
+                    t_next[axis]  = infinity;
+                    t_delta[axis] = infinity;
+                }
+            }
+
+            while (true) {
+                int    axis   = (t_next[0] < t_next[1]) ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+                double t_exit = t_next[axis];
+
+                int c = cell_index(cell[0], cell[1], cell[2]);
+                if (cell_start[c] < cell_start[c + 1] && visit(c, t_exit)) {
+                    return;
+                }
+
+                if (t_exit > ray_t.max || t_exit > t_leave) {
+                    return;
+                }
+
+                cell[axis] += step[axis];
+                if (cell[axis] < 0 || cell[axis] >= cells[axis]) {
+                    return;
+                }
+                t_next[axis] += t_delta[axis];
+            }
+        }
+};
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
+
 class material;
 
 class hit_record {
@@ -8,7 +10,11 @@ class hit_record {
         point3 p;
         vec3 normal;
         shared_ptr<material> mat;
+        int material_index = -1;   // Index into a variant_scene's materials, -1 to use `mat`
         double t;
+        double u;
+        double v;
+        double footprint;   // Width of the ray cone at the hit, in texture (u, v) units
         bool front_face;
 
         void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -25,6 +31,51 @@ class hittable {
         virtual ~hittable() = default;
 
         virtual bool hit(const ray&r, interval ray_t, hit_record& rec) const = 0;
+
+        virtual bool occluded(const ray& r, interval ray_t) const {
+            // Returns true if anything is hit in `ray_t`, without caring which hit is closest.
+            // Override this where an early-out is cheaper than a full `hit`.
+            hit_record rec;
+            return hit(r, ray_t, rec);
+        }
+
+        virtual aabb bounding_box() const = 0;
+};
+
+class translate : public hittable {
+    public:
+        translate(shared_ptr<hittable> object, const vec3& offset) : object{ object }, offset{ offset } {}
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            // Move the ray backwards by the offset, intersect in object space, then move the
+            // intersection point forwards by the offset.
+            ray offset_r(r.origin() - offset, r.direction(), r.cone_width(), r.cone_spread());
+
+            if (!object->hit(offset_r, ray_t, rec)) {
+                return false;
+            }
+
+            rec.p += offset;
+            return true;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            ray offset_r(r.origin() - offset, r.direction());
+            return object->occluded(offset_r, ray_t);
+        }
+
+        aabb bounding_box() const override {
+            return object->bounding_box() + offset;
+        }
+
+        // The offset may change between frames of an animation. Any acceleration structure holding
+        // this object has to be refitted afterwards.
+        const vec3& get_offset() const { return offset; }
+        void set_offset(const vec3& new_offset) { offset = new_offset; }
+
+    private:
+        shared_ptr<hittable> object;
+        vec3                 offset;
 };
 
 #endif
\ No newline at end of file
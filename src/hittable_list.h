@@ -18,7 +18,7 @@ class hittable_list : public hittable {
             objects.push_back(object);
         }
 
-        bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
             hit_record temp_rec;
             bool hit_anything = false;
             double closest_so_far = ray_t.max;
@@ -33,6 +33,25 @@ class hittable_list : public hittable {
 
             return hit_anything;
         }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            for (const auto& object : objects) {
+                if (object->occluded(r, ray_t)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        aabb bounding_box() const override {
+            // Computed on demand rather than cached in `add`, since animated objects can move.
+            aabb bbox;
+            for (const auto& object : objects) {
+                bbox = aabb(bbox, object->bounding_box());
+            }
+            return bbox;
+        }
 };
 
 #endif
\ No newline at end of file
@@ -5,19 +5,25 @@ class interval {
     public:
         double min, max;
 
-        interval() : min{ +infinity }, max{ infinity } {}
+        interval() : min{ +infinity }, max{ -infinity } {} // Default interval is empty
 
         interval(double min, double max) : min{ min }, max{ max } {}
 
+        interval(const interval& a, const interval& b) {
+            // Create the interval tightly enclosing the two input intervals.
+            min = a.min <= b.min ? a.min : b.min;
+            max = a.max >= b.max ? a.max : b.max;
+        }
+
         double size() const {
             return max - min;
         }
 
-        bool contains(double x) {
+        bool contains(double x) const {
             return (min <= x) && (x <= max);
         }
 
-        bool surrounds(double x) {
+        bool surrounds(double x) const {
             return (min < x) && (x < max);
         }
 
@@ -27,10 +33,15 @@ class interval {
             return x;
         }
 
+        interval expand(double delta) const {
+            double padding = delta / 2;
+            return interval(min - padding, max + padding);
+        }
+
         static const interval empty, universe;
 };
 
 const interval empty    = interval(+infinity, -infinity);
 const interval universe = interval(-infinity, infinity);    
 
-#endif
\ No newline at end of file
+#endif
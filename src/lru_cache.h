@@ -0,0 +1,93 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Thread-safe cache of immutable values, evicted least recently used first once their total size
+// exceeds a memory budget. Values are handed out as shared pointers, so one that is evicted while
+// a caller still holds it stays alive until released.
+template <typename key_type, typename value_type>
+class lru_cache {
+    public:
+        lru_cache(size_t budget) : budget{ budget } {}
+
+        void set_budget(size_t bytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+            budget = bytes;
+            evict();
+        }
+
+        shared_ptr<const value_type> find(const key_type& key) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto found = entries.find(key);
+            if (found == entries.end()) {
+                miss_count++;
+                return nullptr;
+            }
+
+            hit_count++;
+            lru.splice(lru.begin(), lru, found->second.position);
+            return found->second.data;
+        }
+
+        void insert(const key_type& key, shared_ptr<const value_type> data, size_t bytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (entries.count(key) > 0) {
+                return;     // Another thread made the same value first.
+            }
+
+            lru.push_front(key);
+            entries[key] = entry{ data, bytes, lru.begin() };
+            resident += bytes;
+            evict();
+        }
+
+        void erase(const key_type& key) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto found = entries.find(key);
+            if (found == entries.end()) {
+                return;
+            }
+
+            resident -= found->second.bytes;
+            lru.erase(found->second.position);
+            entries.erase(found);
+        }
+
+        long long hits() const { return hit_count; }
+        long long misses() const { return miss_count; }
+        size_t resident_bytes() const { return resident; }
+
+    private:
+        struct entry {
+            shared_ptr<const value_type>             data;
+            size_t                                   bytes;
+            typename std::list<key_type>::iterator   position;
+        };
+
+        std::mutex                               mutex;
+        size_t                                   budget;
+        std::atomic<size_t>                      resident{ 0 };
+        std::list<key_type>                      lru;      // Most recently used first
+        std::unordered_map<key_type, entry>      entries;
+        std::atomic<long long>                   hit_count{ 0 };
+        std::atomic<long long>                   miss_count{ 0 };
+
+        void evict() {
+            // Always keeps the newest value, even if it alone exceeds the budget.
+            while (lru.size() > 1 && resident > budget) {
+                auto oldest = entries.find(lru.back());
+                resident -= oldest->second.bytes;
+                entries.erase(oldest);
+                lru.pop_back();
+            }
+        }
+};
+
+#endif
@@ -1,108 +1,72 @@
 #include "common.h"
 
+#include "animation.h"
+#include "bvh.h"
 #include "camera.h"
+#include "dynamic_bvh.h"
+#include "grid.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include "material.h"
-#include "sphere.h"
-#include "triangle.h"
-
-
-void create_world_1(hittable_list& world) {
-    shared_ptr<material> material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    shared_ptr<material> material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    shared_ptr<material> material_left = make_shared<dielectric>(1.50);
-    shared_ptr<material> material_bubble = make_shared<dielectric>(1.00 / 1.50);
-    shared_ptr<material> material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 0.9);
-    shared_ptr<material> material_back = make_shared<metal>(color(0.8, 0.6, 0.2), 0.01);
-
-    world.add(make_shared<sphere>(point3(0.0, -10000.55, -1.0), 10000.0, material_ground));
-    world.add(make_shared<sphere>(point3(0.0, 0.0, -1.2), 0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.48, material_bubble));
-    world.add(make_shared<sphere>(point3(-3, 0.0, -4.0), 0.5, material_back));
-    world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
-}
-
-void create_world_2(hittable_list& world) {
-    auto R = cos(pi / 4);
-
-    auto material_left = make_shared<lambertian>(color(0, 0, 1));
-    auto material_right = make_shared<lambertian>(color(1, 0, 0));
-
-    world.add(make_shared<sphere>(point3(-R, 0, -1), R, material_left));
-    world.add(make_shared<sphere>(point3(R, 0, -1), R, material_right));
-}
-
-void create_world_3(hittable_list& world) {
-    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    auto material_left = make_shared<dielectric>(1.50);
-    auto material_bubble = make_shared<dielectric>(1.00 / 1.50);
-    auto material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 1.0);
-
-    world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
-    world.add(make_shared<sphere>(point3(0.0, 0.0, -1.2), 0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.4, material_bubble));
-    world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
-}
-
-void create_world_4(hittable_list& world) {
-    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    auto material_right = make_shared<metal>(color(1, 0.5, 0.5), 0.00);
-
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -0.7), 0.5, material_ground));
-
-    world.add(make_shared<triangle>(point3(0.5, -0.5, -0.5), point3(0.5, -0.5, -1.5), point3(-4, 2.0, 0.5), material_right));
-    world.add(make_shared<triangle>(point3(0.5, -0.5, -1.5), point3(-4, 10, -1.0), point3(-4, 10, -1.0), material_right));
-}
-
-int main() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+#include "scenes.h"
+#include "streamed_scene.h"
+
+
+int main(int argc, char* argv[]) {
+    // Optional flags:
+    //   --sequence <frames>  renders a turntable animation headlessly into results/
+    //   --output <file>      renders a single image headlessly into <file>
+    //   --cost               records the per-pixel cost AOV (H cycles heatmaps, P dumps them)
+    //   --environment <file> lights the scene with an equirectangular .hdr or .pfm map
+    //   --scene <id>         renders another scene from scenes.h instead of "final"
+    //   --accelerator <name> list (default), bvh, dynamic or grid, for the viewer and --output
+    //   --stream <file>      writes the scene's geometry to <file> and renders it from there
+    //   --stream-budget <KiB> memory for resident clusters of a streamed scene (default 1024)
+    int         sequence_frames = 0;
+    std::string scene_id        = "final";
+    std::string output_filename;
+    std::string environment_filename;
+    std::string stream_filename;
+    std::string accelerator     = "list";
+    size_t      stream_budget   = 1024;
+    bool        record_cost     = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--sequence" && i + 1 < argc) {
+            sequence_frames = std::stoi(argv[++i]);
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            output_filename = argv[++i];
+        }
+        else if (arg == "--environment" && i + 1 < argc) {
+            environment_filename = argv[++i];
+        }
+        else if (arg == "--scene" && i + 1 < argc) {
+            scene_id = argv[++i];
+        }
+        else if (arg == "--accelerator" && i + 1 < argc) {
+            accelerator = argv[++i];
+        }
+        else if (arg == "--stream" && i + 1 < argc) {
+            stream_filename = argv[++i];
+        }
+        else if (arg == "--stream-budget" && i + 1 < argc) {
+            stream_budget = std::stoul(argv[++i]);
+        }
+        else if (arg == "--cost") {
+            record_cost = true;
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
+    hittable_list         world;
+    shared_ptr<translate> glass_sphere;
+    if (scene_id == "final") {
+        glass_sphere = create_world_final(world);
+    }
+    else if (!create_world(scene_id, world)) {
+        std::cerr << "Unknown scene " << scene_id << '\n';
+        return 1;
+    }
 
     camera cam;
 
@@ -134,7 +98,119 @@ int main() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10;
 
-    cam.render(world);
+    cam.record_cost   = record_cost;
+
+    if (!environment_filename.empty()) {
+        cam.background = make_shared<environment>();
+        if (!cam.background->load(environment_filename)) {
+            std::cerr << "Cannot load environment map " << environment_filename << '\n';
+            return 1;
+        }
+    }
+
+    if (sequence_frames > 0 && glass_sphere) {
+        // Turntable: the camera orbits the origin once while the glass sphere bounces.
+        double frames_per_second = 24;
+        double duration          = sequence_frames / frames_per_second;
+
+        animation anim;
+        for (int key = 0; key <= 16; key++) {
+            double time  = duration * key / 16;
+            double angle = 2 * pi * key / 16;
+            anim.lookfrom.add(time, point3(13 * cos(angle) - 3 * sin(angle), 2, 13 * sin(angle) + 3 * cos(angle)));
+        }
+
+        keyframe_track<vec3> bounce;
+        for (int key = 0; key <= 4; key++) {
+            bounce.add(duration * key / 4, vec3(0, (key % 2) ? 0.5 : 0.0, 0));
+        }
+        anim.animate(glass_sphere, bounce);
+
+        cam.samples_per_pixel = 10;
+
+        bvh world_bvh(world);
+        cam.render_sequence(world_bvh, anim, sequence_frames, frames_per_second, "results/frame_");
+        return 0;
+    }
+
+    if (!stream_filename.empty()) {
+        // Only the cluster hierarchy, the materials and the objects that can't be streamed stay in
+        // memory; the rest is paged in from the file as rays reach it.
+        std::vector<shared_ptr<material>> materials;
+        hittable_list                     others;
+        if (!streamed_scene::write(stream_filename, world, materials, others)) {
+            std::cerr << "Cannot write " << stream_filename << '\n';
+            return 1;
+        }
+        world.clear();
+
+        shared_ptr<streamed_scene> streamed = streamed_scene::open(stream_filename, materials, others, stream_budget * 1024);
+        if (!streamed) {
+            std::cerr << "Cannot read " << stream_filename << '\n';
+            return 1;
+        }
+
+        if (!output_filename.empty()) {
+            cam.samples_per_pixel = 10;
+            if (!cam.render_to_file(*streamed, output_filename)) {
+                std::cerr << "Cannot write " << output_filename << '\n';
+                return 1;
+            }
+        }
+        else {
+            cam.render(*streamed);
+        }
+
+        std::clog << "Geometry cache: " << streamed->cluster_count() << " clusters, " << streamed->cache_hits() << " hits, "
+                  << streamed->cache_misses() << " misses, " << streamed->cluster_loads() << " loads, "
+                  << streamed->deferred_rays() << " deferred rays, " << streamed->resident_bytes() / 1024 << " KiB resident\n";
+        if (streamed->read_failures() > 0) {
+            std::cerr << "Failed to read " << streamed->read_failures() << " clusters from " << stream_filename
+                      << "; the image is missing their geometry\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    auto build_start = std::chrono::steady_clock::now();
+
+    shared_ptr<hittable> scene;
+    if (accelerator == "list")      scene = make_shared<hittable_list>(world);
+    else if (accelerator == "bvh")  scene = make_shared<bvh>(world);
+    else if (accelerator == "grid") scene = make_shared<grid>(world);
+    else if (accelerator == "dynamic") {
+        auto tree = make_shared<dynamic_bvh>();
+        for (const auto& object : world.objects) {
+            tree->insert(object);
+        }
+        scene = tree;
+    }
+    else {
+        std::cerr << "Unknown accelerator " << accelerator << '\n';
+        return 1;
+    }
+
+    std::clog << "Built " << accelerator << " in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count() << " ms\n";
+
+    if (!output_filename.empty()) {
+        cam.samples_per_pixel = 10;
+        auto trace_start = std::chrono::steady_clock::now();
+        if (!cam.render_to_file(*scene, output_filename)) {
+            std::cerr << "Cannot write " << output_filename << '\n';
+            return 1;
+        }
+        std::clog << "Rendered in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - trace_start).count() << " s\n";
+
+        texture_cache& textures = texture_cache::shared();
+        if (textures.hits() + textures.misses() > 0) {
+            std::clog << "Texture cache: " << textures.hits() << " hits, " << textures.misses() << " misses, "
+                      << textures.resident_bytes() / 1024 << " KiB resident\n";
+        }
+        return 0;
+    }
+
+    cam.render(*scene);
     
     return 0;
 }
\ No newline at end of file
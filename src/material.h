@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "hittable.h";
+#include "texture.h"
 
 class material {
 	public:
@@ -13,35 +14,54 @@ class material {
 		) const {
 			return false;
 		}
+
+		virtual bool diffuse_albedo(const hit_record& rec, color& albedo) const {
+			// Returns true for ideal diffuse materials, whose scattered rays follow a cosine
+			// distribution; the camera then also samples lights directly at these hits.
+			return false;
+		}
+
+		virtual double cone_spread() const {
+			// How much a bounce off this material widens the ray cone, in radians. Blurry bounces
+			// only need coarse texture detail further down the path.
+			return 0;
+		}
 };
 
 
 class lambertian : public material {
 	public:
-		lambertian(const color& albedo) : albedo{ albedo } {}
+		lambertian(const color& albedo) : tex{ make_shared<solid_color>(albedo) } {}
+		lambertian(shared_ptr<texture> tex) : tex{ tex } {}
 
 
 		bool scatter(
 			const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 		) const override {
-			vec3 scatter_direction = rec.normal + random_unit_vector();
-
-			// Catch degenerate scatter direction
-			if (scatter_direction.near_zero()) {
-				scatter_direction = rec.normal;
-			}
+			// Cosine weighted around the normal.
+			vec3 scatter_direction = to_normal_frame(rec.normal, cosine_hemisphere(random_double(), random_double()));
 
 			scattered = ray(rec.p, scatter_direction);
-			attenuation = albedo;
+			attenuation = tex->value(rec.u, rec.v, rec.footprint, rec.p);
 			return true;
 		}
+
+		bool diffuse_albedo(const hit_record& rec, color& albedo) const override {
+			albedo = tex->value(rec.u, rec.v, rec.footprint, rec.p);
+			return true;
+		}
+
+		double cone_spread() const override {
+			return 1.0;
+		}
 	private:
-		color albedo;
+		shared_ptr<texture> tex;
 };
 
 class metal : public material {
 	public:
-		metal(const color& albedo, double fuzz) : albedo{ albedo }, fuzz{ (fuzz < 1) ? fuzz : 1 } {}
+		metal(const color& albedo, double fuzz) : metal(make_shared<solid_color>(albedo), fuzz) {}
+		metal(shared_ptr<texture> tex, double fuzz) : tex{ tex }, fuzz{ (fuzz < 1) ? fuzz : 1 } {}
 
 		bool scatter(
 			const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
@@ -49,11 +69,15 @@ class metal : public material {
 			vec3 reflection_direction = reflect(r_in.direction(), rec.normal);
 			reflection_direction = unit_vector(reflection_direction) + fuzz * random_unit_vector();
 			scattered = ray(rec.p, reflection_direction);
-			attenuation = albedo;
+			attenuation = tex->value(rec.u, rec.v, rec.footprint, rec.p);
 			return (dot(reflection_direction, rec.normal) > 0);
 		}
+
+		double cone_spread() const override {
+			return fuzz;
+		}
 	private:
-		color albedo;
+		shared_ptr<texture> tex;
 		double fuzz;
 };
 
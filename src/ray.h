@@ -9,16 +9,30 @@ class ray {
 
         ray(const point3& origin, const vec3& direction) : orig{origin}, dir{direction} {}
 
+        ray(const point3& origin, const vec3& direction, double width, double spread)
+            : orig{origin}, dir{direction}, width{width}, spread{spread} {}
+
         const point3& origin() const { return orig; }
         const vec3& direction() const { return dir; }
 
         point3 at(double t) const {
             return orig + t * dir;
         } 
+
+        // Rays carry a cone used to pick texture detail: `width` at the origin, growing by
+        // `spread` per unit of distance travelled.
+        double cone_width() const { return width; }
+        double cone_spread() const { return spread; }
+
+        double cone_width_at(double t) const {
+            return width + spread * t * dir.length();
+        }
     
     private:
         point3 orig;
         vec3 dir;
+        double width  = 0;
+        double spread = 0;
 };
 
 
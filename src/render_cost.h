@@ -0,0 +1,123 @@
+#ifndef RENDER_COST_H
+#define RENDER_COST_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Per-thread work counters. Primitives bump `intersection_tests` on every test and the camera
+// bumps `rays` for every ray it traces; the camera reads the difference around each pixel.
+struct render_counters {
+    long long intersection_tests = 0;
+    long long rays               = 0;
+};
+
+inline thread_local render_counters counters;
+
+// Per-pixel render cost, accumulated over samples: wall time, primitive intersection tests and
+// bounces (rays traced after the camera ray).
+class cost_map {
+    public:
+        enum channel { time, intersection_tests, bounces, channel_count };
+
+        static const char* channel_name(channel c) {
+            static const char* names[] = { "time", "tests", "bounces" };
+            return names[c];
+        }
+
+        void resize(int new_width, int new_height) {
+            width  = new_width;
+            height = new_height;
+            clear();
+        }
+
+        void clear() {
+            for (auto& values : sums) {
+                values.assign(size_t(width) * height, 0.0);
+            }
+            samples.assign(size_t(width) * height, 0);
+        }
+
+        void record(int i, int j, double nanoseconds, long long tests, long long rays) {
+            size_t index = size_t(j) * width + i;
+            sums[time][index]               += nanoseconds;
+            sums[intersection_tests][index] += double(tests);
+            sums[bounces][index]            += double(rays > 0 ? rays - 1 : 0);
+            samples[index]                  += 1;
+        }
+
+        std::vector<color> heatmap(channel c) const {
+            // False colour image of the per-sample average, scaled so the 99th percentile is red.
+            std::vector<double> values(samples.size(), 0.0);
+            for (size_t k = 0; k < samples.size(); k++) {
+                if (samples[k] > 0) {
+                    values[k] = sums[c][k] / samples[k];
+                }
+            }
+
+            double scale = percentile(values, 0.99);
+            scale = (scale > 0) ? 1 / scale : 0;
+
+            std::vector<color> image(values.size());
+            for (size_t k = 0; k < values.size(); k++) {
+                image[k] = false_colour(values[k] * scale);
+            }
+            return image;
+        }
+
+        void write(const std::string& filename_prefix) const {
+            // Writes one heatmap per channel as `<filename_prefix>_cost_<channel>.ppm` and logs
+            // the mean and maximum of each channel.
+            for (int c = 0; c < channel_count; c++) {
+                std::vector<color> image = heatmap(channel(c));
+
+                std::ofstream output_file(filename_prefix + "_cost_" + channel_name(channel(c)) + ".ppm");
+                output_file << "P3\n" << width << ' ' << height << "\n255\n";
+                for (const color& pixel_color : image) {
+                    write_color(output_file, pixel_color);
+                }
+
+                double total = 0, peak = 0;
+                for (size_t k = 0; k < samples.size(); k++) {
+                    if (samples[k] > 0) {
+                        double value = sums[c][k] / samples[k];
+                        total += value;
+                        peak   = std::max(peak, value);
+                    }
+                }
+                std::clog << "Cost " << channel_name(channel(c)) << ": mean "
+                          << total / std::max<size_t>(1, samples.size()) << ", max " << peak << " per sample\n";
+            }
+        }
+
+    private:
+        int                 width  = 0;
+        int                 height = 0;
+        std::vector<double> sums[channel_count];
+        std::vector<int>    samples;
+
+        static double percentile(std::vector<double> values, double fraction) {
+            if (values.empty()) {
+                return 0;
+            }
+            size_t k = size_t(fraction * (values.size() - 1));
+            std::nth_element(values.begin(), values.begin() + k, values.end());
+            return values[k];
+        }
+
+        static color false_colour(double x) {
+            // Blue -> cyan -> green -> yellow -> red ramp over [0, 1].
+            static const color stops[] = {
+                color(0.0, 0.0, 0.5), color(0.0, 0.6, 1.0), color(0.0, 0.8, 0.2),
+                color(1.0, 0.9, 0.0), color(1.0, 0.0, 0.0)
+            };
+            static const interval unit{ 0, 1 };
+
+            double position = unit.clamp(x) * 4;
+            int    stop     = std::min(3, int(position));
+            double a        = position - stop;
+            return (1 - a) * stops[stop] + a * stops[stop + 1];
+        }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <string>
+#include <vector>
+
+void create_world_1(hittable_list& world) {
+    shared_ptr<material> material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
+    shared_ptr<material> material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
+    shared_ptr<material> material_left = make_shared<dielectric>(1.50);
+    shared_ptr<material> material_bubble = make_shared<dielectric>(1.00 / 1.50);
+    shared_ptr<material> material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 0.9);
+    shared_ptr<material> material_back = make_shared<metal>(color(0.8, 0.6, 0.2), 0.01);
+
+    world.add(make_shared<sphere>(point3(0.0, -10000.55, -1.0), 10000.0, material_ground));
+    world.add(make_shared<sphere>(point3(0.0, 0.0, -1.2), 0.5, material_center));
+    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
+    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.48, material_bubble));
+    world.add(make_shared<sphere>(point3(-3, 0.0, -4.0), 0.5, material_back));
+    world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+}
+
+void create_world_2(hittable_list& world) {
+    auto R = cos(pi / 4);
+
+    auto material_left = make_shared<lambertian>(color(0, 0, 1));
+    auto material_right = make_shared<lambertian>(color(1, 0, 0));
+
+    world.add(make_shared<sphere>(point3(-R, 0, -1), R, material_left));
+    world.add(make_shared<sphere>(point3(R, 0, -1), R, material_right));
+}
+
+void create_world_3(hittable_list& world) {
+    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
+    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
+    auto material_left = make_shared<dielectric>(1.50);
+    auto material_bubble = make_shared<dielectric>(1.00 / 1.50);
+    auto material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 1.0);
+
+    world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
+    world.add(make_shared<sphere>(point3(0.0, 0.0, -1.2), 0.5, material_center));
+    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
+    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.4, material_bubble));
+    world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+}
+
+void create_world_4(hittable_list& world) {
+    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
+    auto material_right = make_shared<metal>(color(1, 0.5, 0.5), 0.00);
+
+    world.add(make_shared<sphere>(point3(-1.0, 0.0, -0.7), 0.5, material_ground));
+
+    world.add(make_shared<triangle>(point3(0.5, -0.5, -0.5), point3(0.5, -0.5, -1.5), point3(-4, 2.0, 0.5), material_right));
+    world.add(make_shared<triangle>(point3(0.5, -0.5, -1.5), point3(-4, 10, -1.0), point3(-4, 10, -1.0), material_right));
+}
+
+shared_ptr<translate> create_world_final(hittable_list& world) {
+    // The random sphere field from the end of the book. Returns the big glass sphere, wrapped in a
+    // translate so animations can move it.
+    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(albedo);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else {
+                    // glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.5);
+    auto glass_sphere = make_shared<translate>(make_shared<sphere>(point3(0, 1, 0), 1.0, material1), vec3(0, 0, 0));
+    world.add(glass_sphere);
+
+    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    return glass_sphere;
+}
+
+void create_world_textured(hittable_list& world) {
+    // A tiled image texture on the ground shows the mip levels fading in with distance, next to a
+    // checkered sphere and a textured quad made of two triangles.
+    int grid_size = 256;
+    std::vector<uint8_t> grid(size_t(grid_size) * grid_size * 3);
+    for (int j = 0; j < grid_size; j++) {
+        for (int i = 0; i < grid_size; i++) {
+            bool line = (i % 16 == 0) || (j % 16 == 0);
+            uint8_t* texel = &grid[(size_t(j) * grid_size + i) * 3];
+            texel[0] = line ? 30 : 230;
+            texel[1] = line ? 30 : 220;
+            texel[2] = line ? 30 : 200;
+        }
+    }
+
+    auto grid_texture    = make_shared<image_texture>(grid_size, grid_size, grid);
+    auto checker         = make_shared<checker_texture>(0.25, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    auto material_ground = make_shared<lambertian>(grid_texture);
+    auto material_ball   = make_shared<lambertian>(checker);
+    auto material_mirror = make_shared<metal>(grid_texture, 0.05);
+    auto material_quad   = make_shared<lambertian>(grid_texture);
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, material_ground));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material_ball));
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material_mirror));
+
+    point3 q0(-1, 0, -2), q1(1, 0, -2), q2(1, 2, -2), q3(-1, 2, -2);
+    world.add(make_shared<triangle>(q0, q1, q2, vec3(0, 0, 0), vec3(1, 0, 0), vec3(1, 1, 0), material_quad));
+    world.add(make_shared<triangle>(q0, q2, q3, vec3(0, 0, 0), vec3(1, 1, 0), vec3(0, 1, 0), material_quad));
+}
+
+bool create_world(const std::string& id, hittable_list& world) {
+    // Builds the scene with the given id into `world`. Returns false for an unknown id.
+    if (id == "1")          create_world_1(world);
+    else if (id == "2")     create_world_2(world);
+    else if (id == "3")     create_world_3(world);
+    else if (id == "4")     create_world_4(world);
+    else if (id == "final") create_world_final(world);
+    else if (id == "textured") create_world_textured(world);
+    else                    return false;
+
+    return true;
+}
+
+#endif
@@ -8,6 +8,20 @@ class sphere : public hittable {
         sphere(const point3& center, double radius, shared_ptr<material> mat) : center{ center }, radius{ fmax(0, radius) }, mat{ mat } {}
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            double root;
+            if (!intersect(r, ray_t, root)) {
+                return false;
+            }
+
+            set_hit_record(r, root, rec);
+            return true;
+        }
+
+        bool intersect(const ray& r, interval ray_t, double& root) const {
+            // Finds the nearest root in `ray_t` without filling a hit record, so a caller testing
+            // many spheres only fills one record, for the closest.
+            counters.intersection_tests++;
+
             vec3 oc = center - r.origin();
             double a = r.direction().length_squared();
             double h = dot(r.direction(), oc);
@@ -21,7 +35,7 @@ class sphere : public hittable {
             double sqrtd = sqrt(discriminant);
 
             // Find the nearest root that lies in the acceptable range.
-            double root = (h - sqrtd) / a;
+            root = (h - sqrtd) / a;
             if (!ray_t.surrounds(root)) {
                 root = (h + sqrtd) / a;
                 if (!ray_t.surrounds(root)) {
@@ -29,19 +43,66 @@ class sphere : public hittable {
                 }
             }
 
+            return true;
+        }
+
+        void set_hit_record(const ray& r, double root, hit_record& rec) const {
+            set_hit_geometry(r, root, rec);
+            rec.mat = mat;
+        }
+
+        void set_hit_geometry(const ray& r, double root, hit_record& rec) const {
+            // Everything but the material, for callers that look materials up by index.
             rec.t = root;
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - center) / radius;
             rec.set_face_normal(r, outward_normal);
-            rec.mat = mat;
+            get_sphere_uv(outward_normal, rec.u, rec.v);
+            rec.footprint = r.cone_width_at(rec.t) / (pi * radius);  // v spans half a circumference
+        }
 
-            return true;
+        bool occluded(const ray& r, interval ray_t) const override {
+            counters.intersection_tests++;
+
+            vec3 oc = center - r.origin();
+            double a = r.direction().length_squared();
+            double h = dot(r.direction(), oc);
+            double c = oc.length_squared() - radius * radius;
+
+            double discriminant = h * h - a * c;
+            if (discriminant < 0) {
+                return false;
+            }
+
+            // Either root in range blocks the segment; no need to find the nearest one.
+            double sqrtd = sqrt(discriminant);
+            return ray_t.surrounds((h - sqrtd) / a) || ray_t.surrounds((h + sqrtd) / a);
+        }
+
+        const point3& get_center() const { return center; }
+        double get_radius() const { return radius; }
+        const shared_ptr<material>& get_material() const { return mat; }
+
+        aabb bounding_box() const override {
+            vec3 rvec = vec3(radius, radius, radius);
+            return aabb(center - rvec, center + rvec);
         }
 
     private:
         point3 center;
         double radius;
         shared_ptr<material> mat;
+
+        static void get_sphere_uv(const point3& p, double& u, double& v) {
+            // p: a given point on the sphere of radius one, centered at the origin.
+            // u: returned value [0,1] of angle around the Y axis from X=-1.
+            // v: returned value [0,1] of angle from Y=-1 to Y=+1.
+            double theta = acos(-p.y());
+            double phi   = atan2(-p.z(), p.x()) + pi;
+
+            u = phi / (2 * pi);
+            v = theta / pi;
+        }
 };
 
 
@@ -0,0 +1,547 @@
+#ifndef STREAMED_SCENE_H
+#define STREAMED_SCENE_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "lru_cache.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+// Spheres and triangles of one spatial cluster, as paged in from a cluster file.
+struct geometry_cluster {
+    std::vector<sphere>   spheres;
+    std::vector<triangle> triangles;
+
+    size_t bytes() const {
+        return sizeof(geometry_cluster) + spheres.capacity() * sizeof(sphere) + triangles.capacity() * sizeof(triangle);
+    }
+};
+
+// Resident clusters of a streamed_scene, charged to the memory budget by their size.
+using cluster_cache = lru_cache<int, geometry_cluster>;
+
+// A scene whose spheres and triangles live in a file instead of memory. `write` splits a scene
+// into spatial clusters of a few dozen primitives and stores them together with a hierarchy over
+// the clusters' bounds. Only that hierarchy stays in memory; the leaves reference clusters, which
+// are read from the file on first use and kept in a cluster_cache with a fixed memory budget.
+//
+// `hit` and `occluded` wait for a missing cluster to be read. `hit_batch` instead sets aside the
+// rays that reach a non-resident cluster and carries on with the rest while the cluster is read in
+// the background, once for all of the rays waiting on it.
+//
+// Materials can't be written to the file, so they stay in memory and the file refers to them by
+// index; the same material table has to be passed to `open`. Objects other than plain spheres and
+// triangles are not written and stay in memory as well.
+class streamed_scene final : public hittable {
+    public:
+        static bool write(const std::string& filename, const hittable_list& list, std::vector<shared_ptr<material>>& materials,
+                          hittable_list& others, int cluster_size = 64) {
+            // Appends the materials used by the written primitives to `materials`, and the objects
+            // that were not written to `others`. Returns false if the file can't be written.
+            std::vector<shared_ptr<hittable>>     primitives;
+            std::vector<aabb>                     boxes;
+            std::unordered_map<const material*, int> material_indices;
+
+            for (const auto& object : list.objects) {
+                // Exact type matches only; a subclass would be written as its base class.
+                const hittable& h = *object;
+                const material*  mat;
+                if (typeid(h) == typeid(sphere))        mat = static_cast<const sphere&>(h).get_material().get();
+                else if (typeid(h) == typeid(triangle)) mat = static_cast<const triangle&>(h).get_material().get();
+                else {
+                    others.add(object);
+                    continue;
+                }
+
+                if (material_indices.count(mat) == 0) {
+                    material_indices[mat] = int(materials.size());
+                    materials.push_back(typeid(h) == typeid(sphere) ? static_cast<const sphere&>(h).get_material()
+                                                                    : static_cast<const triangle&>(h).get_material());
+                }
+                primitives.push_back(object);
+                boxes.push_back(object->bounding_box());
+            }
+
+            std::vector<node> nodes;
+            std::vector<int>  cluster_firsts;   // First primitive of each cluster; they are stored in order
+            if (!primitives.empty()) {
+                nodes.push_back(node{ aabb(), 0, -1, 0 });
+                split(0, 0, int(primitives.size()), primitives, boxes, cluster_size, nodes, cluster_firsts);
+            }
+            cluster_firsts.push_back(int(primitives.size()));
+
+            std::ofstream file(filename, std::ios::binary);
+            if (!file) {
+                return false;
+            }
+
+            file_header header;
+            std::memcpy(header.magic, file_magic, sizeof(header.magic));
+            header.node_count    = uint32_t(nodes.size());
+            header.cluster_count = uint32_t(cluster_firsts.size() - 1);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+            for (const node& n : nodes) {
+                node_record record = {};
+                for (int axis = 0; axis < 3; axis++) {
+                    record.min[axis] = n.bbox.axis_interval(axis).min;
+                    record.max[axis] = n.bbox.axis_interval(axis).max;
+                }
+                record.first   = n.first;
+                record.cluster = n.cluster;
+                record.axis    = n.axis;
+                file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            }
+
+            // The directory goes before the payload, so every offset is known up front.
+            uint64_t offset = sizeof(file_header) + nodes.size() * sizeof(node_record)
+                            + header.cluster_count * sizeof(cluster_record);
+            for (uint32_t c = 0; c < header.cluster_count; c++) {
+                cluster_record record = {};
+                record.offset = offset;
+                for (int i = cluster_firsts[c]; i < cluster_firsts[c + 1]; i++) {
+                    if (typeid(*primitives[i]) == typeid(sphere)) record.sphere_count++;
+                    else                                          record.triangle_count++;
+                }
+                file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                offset += record.sphere_count * sizeof(sphere_record) + record.triangle_count * sizeof(triangle_record);
+            }
+
+            for (uint32_t c = 0; c < header.cluster_count; c++) {
+                // Spheres first, then triangles, as `load` expects.
+                for (int i = cluster_firsts[c]; i < cluster_firsts[c + 1]; i++) {
+                    if (typeid(*primitives[i]) != typeid(sphere)) continue;
+
+                    const sphere& s = static_cast<const sphere&>(*primitives[i]);
+                    sphere_record record = {};
+                    for (int axis = 0; axis < 3; axis++) record.center[axis] = s.get_center()[axis];
+                    record.radius   = s.get_radius();
+                    record.material = material_indices[s.get_material().get()];
+                    file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                }
+                for (int i = cluster_firsts[c]; i < cluster_firsts[c + 1]; i++) {
+                    if (typeid(*primitives[i]) != typeid(triangle)) continue;
+
+                    const triangle& t = static_cast<const triangle&>(*primitives[i]);
+                    triangle_record record = {};
+                    for (int k = 0; k < 3; k++) {
+                        for (int axis = 0; axis < 3; axis++) record.points[3 * k + axis] = t.get_point(k)[axis];
+                        record.uvs[2 * k + 0] = t.get_uv(k).x();
+                        record.uvs[2 * k + 1] = t.get_uv(k).y();
+                    }
+                    record.material = material_indices[t.get_material().get()];
+                    file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                }
+            }
+
+            return bool(file);
+        }
+
+        static shared_ptr<streamed_scene> open(const std::string& filename, const std::vector<shared_ptr<material>>& materials,
+                                               const hittable_list& others, size_t cache_budget) {
+            // Reads the cluster hierarchy of a file made by `write`, but none of the clusters.
+            // Returns null if the file can't be read.
+            std::ifstream file(filename, std::ios::binary);
+            file_header   header;
+            if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+                || std::memcmp(header.magic, file_magic, sizeof(header.magic)) != 0) {
+                return nullptr;
+            }
+
+            auto scene = shared_ptr<streamed_scene>(new streamed_scene(filename, materials, others, cache_budget));
+
+            for (uint32_t k = 0; k < header.node_count; k++) {
+                node_record record;
+                if (!file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+                    return nullptr;
+                }
+                aabb bbox(point3(record.min[0], record.min[1], record.min[2]), point3(record.max[0], record.max[1], record.max[2]));
+                scene->nodes.push_back(node{ bbox, record.first, record.cluster, record.axis });
+            }
+
+            scene->directory.resize(header.cluster_count);
+            if (!file.read(reinterpret_cast<char*>(scene->directory.data()), header.cluster_count * sizeof(cluster_record))) {
+                return nullptr;
+            }
+            for (const node& n : scene->nodes) {
+                bool valid = (n.cluster >= 0) ? n.cluster < int(header.cluster_count)
+                                              : n.first > 0 && n.first + 1 < int(header.node_count) && n.axis >= 0 && n.axis < 3;
+                if (!valid) {
+                    return nullptr;
+                }
+            }
+
+            return scene;
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            bool hit_anything = false;
+
+            traverse(r, ray_t, [&](int cluster) {
+                auto data = acquire(cluster);
+                if (data && hit_cluster(*data, r, ray_t, rec)) {
+                    hit_anything = true;
+                }
+                return false;
+            });
+
+            if (!others.objects.empty() && others.hit(r, ray_t, rec)) {
+                hit_anything = true;
+            }
+            return hit_anything;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            bool blocked = traverse(r, ray_t, [&](int cluster) {
+                auto data = acquire(cluster);
+                return data && occluded_cluster(*data, r, ray_t);
+            });
+
+            return blocked || (!others.objects.empty() && others.occluded(r, ray_t));
+        }
+
+        void hit_batch(const std::vector<ray>& rays, interval ray_t, std::vector<hit_record>& records,
+                       std::vector<char>& found) const {
+            // The closest hit of every ray in `rays`, like calling `hit` on each. Rays are first
+            // traced through the resident clusters only; a ray reaching a cluster that isn't
+            // resident is set aside for that cluster, and the cluster's read starts on another
+            // thread right away, so reads overlap with tracing the rest of the batch. The rays set
+            // aside are then tested against each cluster as its read completes.
+            records.assign(rays.size(), hit_record());
+            found.assign(rays.size(), 0);
+            std::vector<double> closest(rays.size(), ray_t.max);
+
+            std::unordered_map<int, shared_ptr<const geometry_cluster>> resident;   // Looked up once per batch
+            std::unordered_map<int, std::vector<int>>                   waiting;    // Rays set aside, by cluster
+
+            // Missing clusters in the order first reached, with a bounded number of reads running.
+            std::vector<int>                                             missing;
+            std::vector<std::future<shared_ptr<const geometry_cluster>>> reads;
+            size_t                                                       finished = 0;
+
+            auto start_reads = [&] {
+                while (reads.size() < missing.size() && reads.size() - finished < max_reads_in_flight) {
+                    int cluster = missing[reads.size()];
+                    reads.push_back(std::async(std::launch::async, [this, cluster] { return load(cluster); }));
+                }
+            };
+
+            for (size_t k = 0; k < rays.size(); k++) {
+                interval ray_k(ray_t.min, closest[k]);
+                traverse(rays[k], ray_k, [&](int cluster) {
+                    auto known = resident.find(cluster);
+                    if (known == resident.end()) {
+                        known = resident.emplace(cluster, cache.find(cluster)).first;
+                        if (!known->second) {
+                            missing.push_back(cluster);
+                            start_reads();
+                        }
+                    }
+
+                    if (!known->second) {
+                        waiting[cluster].push_back(int(k));
+                        deferred_count++;
+                    }
+                    else if (hit_cluster(*known->second, rays[k], ray_k, records[k])) {
+                        found[k] = 1;
+                    }
+                    return false;
+                });
+                closest[k] = ray_k.max;
+            }
+
+            // Let the cache evict what this batch no longer needs while the missing clusters load.
+            resident.clear();
+
+            for (size_t m = 0; m < missing.size(); m++) {
+                shared_ptr<const geometry_cluster> data = reads[m].get();
+                finished = m + 1;
+                start_reads();
+
+                if (!data) {
+                    continue;
+                }
+
+                for (int k : waiting[missing[m]]) {
+                    interval ray_k(ray_t.min, closest[k]);
+                    if (hit_cluster(*data, rays[k], ray_k, records[k])) {
+                        found[k]   = 1;
+                        closest[k] = ray_k.max;
+                    }
+                }
+            }
+
+            if (!others.objects.empty()) {
+                for (size_t k = 0; k < rays.size(); k++) {
+                    if (others.hit(rays[k], interval(ray_t.min, closest[k]), records[k])) {
+                        found[k] = 1;
+                    }
+                }
+            }
+        }
+
+        aabb bounding_box() const override {
+            aabb bbox = others.bounding_box();
+            return nodes.empty() ? bbox : aabb(bbox, nodes[0].bbox);
+        }
+
+        size_t cluster_count() const { return directory.size(); }
+        long long cache_hits() const { return cache.hits(); }
+        long long cache_misses() const { return cache.misses(); }
+        size_t resident_bytes() const { return cache.resident_bytes(); }
+        long long cluster_loads() const { return load_count; }
+        long long deferred_rays() const { return deferred_count; }  // Ray-cluster pairs set aside by hit_batch
+        long long read_failures() const { return failure_count; }   // Cluster reads that failed; their primitives were skipped
+
+    private:
+        static const size_t max_reads_in_flight = 4;    // Cluster reads hit_batch keeps running at once
+
+        struct node {
+            aabb bbox;
+            int  first;    // Left child of an interior node (right is first + 1)
+            int  cluster;  // Cluster of a leaf, -1 for an interior node
+            int  axis;     // Split axis of an interior node
+        };
+
+        // File layout: header, node records, one cluster record per cluster, then each cluster's
+        // sphere records followed by its triangle records. Native byte order.
+        static constexpr char file_magic[8] = { 'R', 'T', 'C', 'L', 'U', 'S', 'T', '1' };
+
+        struct file_header {
+            char     magic[8];
+            uint32_t node_count;
+            uint32_t cluster_count;
+        };
+
+        struct node_record {
+            double  min[3];
+            double  max[3];
+            int32_t first;
+            int32_t cluster;
+            int32_t axis;
+            int32_t padding;
+        };
+
+        struct cluster_record {
+            uint64_t offset;
+            uint32_t sphere_count;
+            uint32_t triangle_count;
+        };
+
+        struct sphere_record {
+            double  center[3];
+            double  radius;
+            int32_t material;
+            int32_t padding;
+        };
+
+        struct triangle_record {
+            double  points[9];
+            double  uvs[6];      // (u, v) per vertex
+            int32_t material;
+            int32_t padding;
+        };
+
+        mutable std::ifstream               file;
+        mutable std::mutex                  file_mutex;
+        std::vector<shared_ptr<material>>   materials;
+        hittable_list                       others;
+        std::vector<node>                   nodes;
+        std::vector<cluster_record>         directory;
+        mutable cluster_cache               cache;
+        mutable std::atomic<long long>      load_count{ 0 };
+        mutable std::atomic<long long>      deferred_count{ 0 };
+        mutable std::atomic<long long>      failure_count{ 0 };
+
+        streamed_scene(const std::string& filename, const std::vector<shared_ptr<material>>& materials,
+                       const hittable_list& others, size_t cache_budget)
+            : file{ filename, std::ios::binary }, materials{ materials }, others{ others }, cache{ cache_budget } {}
+
+        template <typename visit_leaf>
+        bool traverse(const ray& r, interval& ray_t, visit_leaf&& visit) const {
+            // Calls `visit(cluster)` for every leaf whose bounds the ray enters, nearest child first.
+            // `visit` may shrink `ray_t` to cull what lies behind a hit, and returns true to stop
+            // the traversal, in which case this returns true as well.
+            if (nodes.empty()) {
+                return false;
+            }
+
+            int stack[64];
+            int stack_size = 0;
+            stack[stack_size++] = 0;
+
+            while (stack_size > 0) {
+                const node& n = nodes[stack[--stack_size]];
+                if (!n.bbox.hit(r, ray_t)) {
+                    continue;
+                }
+
+                if (n.cluster >= 0) {
+                    if (visit(n.cluster)) {
+                        return true;
+                    }
+                    continue;
+                }
+
+                int left  = n.first;
+                int right = n.first + 1;
+                if (r.direction()[n.axis] < 0) {
+                    std::swap(left, right);
+                }
+                stack[stack_size++] = right;
+                stack[stack_size++] = left;
+            }
+
+            return false;
+        }
+
+        static bool hit_cluster(const geometry_cluster& c, const ray& r, interval& ray_t, hit_record& rec) {
+            bool hit_anything = false;
+
+            for (const sphere& s : c.spheres) {
+                double root;
+                if (s.sphere::intersect(r, ray_t, root)) {
+                    s.set_hit_record(r, root, rec);
+                    ray_t.max    = root;
+                    hit_anything = true;
+                }
+            }
+
+            for (const triangle& t : c.triangles) {
+                vec3   normal;
+                double dot_ray_normal, root;
+                if (t.triangle::intersect(r, ray_t, normal, dot_ray_normal, root)) {
+                    t.set_hit_record(r, root, normal, dot_ray_normal, rec);
+                    ray_t.max    = root;
+                    hit_anything = true;
+                }
+            }
+
+            return hit_anything;
+        }
+
+        static bool occluded_cluster(const geometry_cluster& c, const ray& r, interval ray_t) {
+            for (const sphere& s : c.spheres) {
+                if (s.sphere::occluded(r, ray_t)) return true;
+            }
+            for (const triangle& t : c.triangles) {
+                if (t.triangle::occluded(r, ray_t)) return true;
+            }
+            return false;
+        }
+
+        shared_ptr<const geometry_cluster> acquire(int index) const {
+            shared_ptr<const geometry_cluster> data = cache.find(index);
+            return data ? data : load(index);
+        }
+
+        shared_ptr<const geometry_cluster> load(int index) const {
+            // Reads a cluster from the file into the cache. Returns null if the read fails; the
+            // failure is counted and nothing is cached, so a later lookup tries again.
+            const cluster_record& record = directory[index];
+            std::vector<sphere_record> spheres(record.sphere_count);
+            std::vector<triangle_record> triangles(record.triangle_count);
+
+            {
+                // One handle is shared by every load, so the file reads themselves take turns;
+                // decoding the records runs concurrently, and both overlap with tracing.
+                std::lock_guard<std::mutex> lock(file_mutex);
+                file.clear();
+                file.seekg(std::streamoff(record.offset));
+                file.read(reinterpret_cast<char*>(spheres.data()), spheres.size() * sizeof(sphere_record));
+                file.read(reinterpret_cast<char*>(triangles.data()), triangles.size() * sizeof(triangle_record));
+                if (!file) {
+                    failure_count++;
+                    return nullptr;
+                }
+            }
+
+            auto data = make_shared<geometry_cluster>();
+            data->spheres.reserve(spheres.size());
+            for (const sphere_record& s : spheres) {
+                data->spheres.emplace_back(point3(s.center[0], s.center[1], s.center[2]), s.radius, material_for(s.material));
+            }
+
+            data->triangles.reserve(triangles.size());
+            for (const triangle_record& t : triangles) {
+                data->triangles.emplace_back(point3(t.points[0], t.points[1], t.points[2]),
+                                             point3(t.points[3], t.points[4], t.points[5]),
+                                             point3(t.points[6], t.points[7], t.points[8]),
+                                             vec3(t.uvs[0], t.uvs[1], 0), vec3(t.uvs[2], t.uvs[3], 0), vec3(t.uvs[4], t.uvs[5], 0),
+                                             material_for(t.material));
+            }
+
+            load_count++;
+            cache.insert(index, data, data->bytes());
+            return data;
+        }
+
+        shared_ptr<material> material_for(int index) const {
+            return (index >= 0 && index < int(materials.size())) ? materials[index] : nullptr;
+        }
+
+        static void split(int node_index, int first, int count, std::vector<shared_ptr<hittable>>& primitives,
+                          std::vector<aabb>& boxes, int cluster_size, std::vector<node>& nodes, std::vector<int>& cluster_firsts) {
+            // Median split along the longest axis of the centroids until every leaf holds at most
+            // `cluster_size` primitives. Leaves become clusters in order, so each cluster is a
+            // contiguous range of `primitives`.
+            aabb bbox;
+            aabb centroid_bounds;
+            for (int i = first; i < first + count; i++) {
+                bbox = aabb(bbox, boxes[i]);
+                point3 c = boxes[i].centroid();
+                centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+            }
+            nodes[node_index].bbox = bbox;
+
+            if (count <= cluster_size) {
+                nodes[node_index].cluster = int(cluster_firsts.size());
+                cluster_firsts.push_back(first);
+                return;
+            }
+
+            int axis = centroid_bounds.longest_axis();
+            int mid  = first + count / 2;
+
+            std::vector<int> order(count);
+            for (int i = 0; i < count; i++) {
+                order[i] = first + i;
+            }
+            std::nth_element(order.begin(), order.begin() + count / 2, order.end(), [&](int a, int b) {
+                return boxes[a].centroid()[axis] < boxes[b].centroid()[axis];
+            });
+
+            std::vector<shared_ptr<hittable>> sorted_primitives(count);
+            std::vector<aabb>                 sorted_boxes(count);
+            for (int i = 0; i < count; i++) {
+                sorted_primitives[i] = primitives[order[i]];
+                sorted_boxes[i]      = boxes[order[i]];
+            }
+            std::copy(sorted_primitives.begin(), sorted_primitives.end(), primitives.begin() + first);
+            std::copy(sorted_boxes.begin(), sorted_boxes.end(), boxes.begin() + first);
+
+            int left = int(nodes.size());
+            nodes.push_back(node{ aabb(), 0, -1, 0 });
+            nodes.push_back(node{ aabb(), 0, -1, 0 });
+
+            nodes[node_index].first = left;
+            nodes[node_index].axis  = axis;
+
+            split(left, first, mid - first, primitives, boxes, cluster_size, nodes, cluster_firsts);
+            split(left + 1, mid, first + count - mid, primitives, boxes, cluster_size, nodes, cluster_firsts);
+        }
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "lru_cache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class texture {
+    public:
+        virtual ~texture() = default;
+
+        // `footprint` is the width of the ray cone at the hit in (u, v) units, which image textures
+        // use to pick a mip level.
+        virtual color value(double u, double v, double footprint, const point3& p) const = 0;
+};
+
+class solid_color : public texture {
+    public:
+        solid_color(const color& albedo) : albedo{ albedo } {}
+
+        solid_color(double red, double green, double blue) : solid_color(color(red, green, blue)) {}
+
+        color value(double u, double v, double footprint, const point3& p) const override {
+            return albedo;
+        }
+
+    private:
+        color albedo;
+};
+
+class checker_texture : public texture {
+    public:
+        checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd)
+            : inv_scale{ 1.0 / scale }, even{ even }, odd{ odd } {}
+
+        checker_texture(double scale, const color& c1, const color& c2)
+            : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
+
+        color value(double u, double v, double footprint, const point3& p) const override {
+            int x = int(std::floor(inv_scale * p.x()));
+            int y = int(std::floor(inv_scale * p.y()));
+            int z = int(std::floor(inv_scale * p.z()));
+
+            bool is_even = (x + y + z) % 2 == 0;
+
+            return is_even ? even->value(u, v, footprint, p) : odd->value(u, v, footprint, p);
+        }
+
+    private:
+        double              inv_scale;
+        shared_ptr<texture> even;
+        shared_ptr<texture> odd;
+};
+
+struct texture_tile {
+    static const int size = 8;         // Texels per tile side
+
+    float texels[size * size][3];      // In Morton order within the tile
+};
+
+// Decoded (linear, floating point) texture tiles shared by all image textures, evicted least
+// recently used first once they exceed a fixed memory budget. Image textures keep only compact
+// 8-bit data themselves and decode tiles into this cache on demand. Tiles that threads still
+// remember in `image_texture::fetch_tile` outlive their eviction by a little.
+class texture_cache : public lru_cache<uint64_t, texture_tile> {
+    public:
+        static const int tile_size = texture_tile::size;
+        using tile = texture_tile;
+
+        static texture_cache& shared() {
+            static texture_cache cache;
+            return cache;
+        }
+
+        void insert(uint64_t key, shared_ptr<const tile> data) {
+            lru_cache::insert(key, data, sizeof(tile));
+        }
+
+    private:
+        texture_cache() : lru_cache(64 << 20) {}
+};
+
+class image_texture : public texture {
+    public:
+        // `rgb` holds 8-bit gamma encoded texels, row by row starting at the top.
+        image_texture(int width, int height, const std::vector<uint8_t>& rgb) : id{ next_id++ } {
+            build_levels(width, height, rgb);
+        }
+
+        static shared_ptr<image_texture> load(const std::string& filename) {
+            // Loads a P3 or P6 PPM image, such as the ones the renderer writes. Returns null if the
+            // file can't be read.
+            std::ifstream file(filename, std::ios::binary);
+            std::string   format;
+            int           width, height, max_value;
+            file >> format >> width >> height >> max_value;
+            file.get();
+
+            if (!file || (format != "P3" && format != "P6") || width <= 0 || height <= 0 || max_value <= 0 || max_value > 255) {
+                return nullptr;
+            }
+
+            std::vector<uint8_t> rgb(size_t(width) * height * 3);
+            for (auto& component : rgb) {
+                int value;
+                if (format == "P6") {
+                    value = file.get();
+                }
+                else {
+                    file >> value;
+                }
+                component = uint8_t(255 * value / max_value);
+            }
+
+            if (!file) {
+                return nullptr;
+            }
+            return make_shared<image_texture>(width, height, rgb);
+        }
+
+        color value(double u, double v, double footprint, const point3& p) const override {
+            // Trilinear filtering between the two mip levels closest to the footprint. Texture
+            // coordinates wrap around.
+            u = u - std::floor(u);
+            v = 1.0 - (v - std::floor(v));  // Flip V to image coordinates
+
+            int    max_level = int(levels.size()) - 1;
+            double lod       = (footprint > 0) ? std::log2(footprint * levels[0].width) : 0;
+            lod = interval(0, max_level).clamp(lod);
+
+            int    level = int(lod);
+            double a     = lod - level;
+
+            color result = bilinear(level, u, v);
+            if (a > 0 && level < max_level) {
+                result = (1 - a) * result + a * bilinear(level + 1, u, v);
+            }
+            return result;
+        }
+
+    private:
+        struct mip_level {
+            int                  width;
+            int                  height;
+            int                  tiles_x;
+            std::vector<uint8_t> texels;  // 8-bit gamma encoded RGB, tile by tile, Morton order inside
+        };
+
+        static const int tile_texels = texture_cache::tile_size * texture_cache::tile_size;
+
+        static inline std::atomic<uint32_t> next_id{ 0 };
+
+        uint32_t               id;
+        std::vector<mip_level> levels;
+
+        color bilinear(int level, double u, double v) const {
+            const mip_level& m = levels[level];
+
+            double x  = u * m.width - 0.5;
+            double y  = v * m.height - 0.5;
+            int    x0 = int(std::floor(x));
+            int    y0 = int(std::floor(y));
+            double fx = x - x0;
+            double fy = y - y0;
+
+            return (1 - fy) * ((1 - fx) * texel(level, x0, y0)     + fx * texel(level, x0 + 1, y0))
+                 +      fy  * ((1 - fx) * texel(level, x0, y0 + 1) + fx * texel(level, x0 + 1, y0 + 1));
+        }
+
+        color texel(int level, int x, int y) const {
+            const mip_level& m = levels[level];
+            x = ((x % m.width) + m.width) % m.width;
+            y = ((y % m.height) + m.height) % m.height;
+
+            int tile_index = (y / texture_cache::tile_size) * m.tiles_x + x / texture_cache::tile_size;
+            const float* rgb = fetch_tile(level, tile_index)->texels[morton(x % texture_cache::tile_size, y % texture_cache::tile_size)];
+            return color(rgb[0], rgb[1], rgb[2]);
+        }
+
+        shared_ptr<const texture_cache::tile> fetch_tile(int level, int tile_index) const {
+            // Neighbouring lookups mostly land in the same tile, so each thread remembers the last
+            // tile it used on each mip level and only goes to the shared cache when that changes.
+            // One slot per level, since every trilinear lookup reads two levels.
+            static const int memo_levels = 16;
+            thread_local uint64_t                              last_keys[memo_levels]  = {};
+            thread_local shared_ptr<const texture_cache::tile> last_tiles[memo_levels];
+
+            uint64_t key  = (uint64_t(id) << 40) | (uint64_t(level) << 32) | uint32_t(tile_index);
+            int      slot = level % memo_levels;
+            if (last_tiles[slot] && key == last_keys[slot]) {
+                return last_tiles[slot];
+            }
+
+            texture_cache&                        cache = texture_cache::shared();
+            shared_ptr<const texture_cache::tile> data  = cache.find(key);
+            if (!data) {
+                data = decode_tile(level, tile_index);
+                cache.insert(key, data);
+            }
+
+            last_keys[slot]  = key;
+            last_tiles[slot] = data;
+            return data;
+        }
+
+        shared_ptr<const texture_cache::tile> decode_tile(int level, int tile_index) const {
+            auto data = make_shared<texture_cache::tile>();
+            const uint8_t* source = &levels[level].texels[size_t(tile_index) * tile_texels * 3];
+
+            for (int k = 0; k < tile_texels * 3; k++) {
+                // Undo the renderer's gamma 2 encoding.
+                float value = source[k] / 255.0f;
+                data->texels[k / 3][k % 3] = value * value;
+            }
+            return data;
+        }
+
+        static int morton(int x, int y) {
+            // Interleaves the bits of x and y (each below the tile size of 8).
+            int index = 0;
+            for (int bit = 0; bit < 3; bit++) {
+                index |= ((x >> bit) & 1) << (2 * bit);
+                index |= ((y >> bit) & 1) << (2 * bit + 1);
+            }
+            return index;
+        }
+
+        void build_levels(int width, int height, const std::vector<uint8_t>& rgb) {
+            // Box filters the image down to 1x1 in linear space, storing each level tiled.
+            std::vector<color> linear(size_t(width) * height);
+            for (size_t k = 0; k < linear.size(); k++) {
+                double r = rgb[3 * k + 0] / 255.0, g = rgb[3 * k + 1] / 255.0, b = rgb[3 * k + 2] / 255.0;
+                linear[k] = color(r * r, g * g, b * b);
+            }
+
+            while (true) {
+                store_level(width, height, linear);
+                if (width == 1 && height == 1) {
+                    break;
+                }
+
+                int next_width  = std::max(1, width / 2);
+                int next_height = std::max(1, height / 2);
+                std::vector<color> next(size_t(next_width) * next_height);
+
+                for (int j = 0; j < next_height; j++) {
+                    for (int i = 0; i < next_width; i++) {
+                        int x0 = std::min(2 * i, width - 1),  x1 = std::min(2 * i + 1, width - 1);
+                        int y0 = std::min(2 * j, height - 1), y1 = std::min(2 * j + 1, height - 1);
+                        next[size_t(j) * next_width + i] = 0.25 * (linear[size_t(y0) * width + x0] + linear[size_t(y0) * width + x1]
+                                                                 + linear[size_t(y1) * width + x0] + linear[size_t(y1) * width + x1]);
+                    }
+                }
+
+                linear.swap(next);
+                width  = next_width;
+                height = next_height;
+            }
+        }
+
+        void store_level(int width, int height, const std::vector<color>& linear) {
+            mip_level m;
+            m.width   = width;
+            m.height  = height;
+            m.tiles_x = (width + texture_cache::tile_size - 1) / texture_cache::tile_size;
+            int tiles_y = (height + texture_cache::tile_size - 1) / texture_cache::tile_size;
+            m.texels.assign(size_t(m.tiles_x) * tiles_y * tile_texels * 3, 0);
+
+            static const interval intensity{ 0, 0.999 };
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    int    tile_index = (y / texture_cache::tile_size) * m.tiles_x + x / texture_cache::tile_size;
+                    size_t offset     = (size_t(tile_index) * tile_texels + morton(x % texture_cache::tile_size, y % texture_cache::tile_size)) * 3;
+                    const color& c    = linear[size_t(y) * width + x];
+                    for (int component = 0; component < 3; component++) {
+                        m.texels[offset + component] = uint8_t(256 * intensity.clamp(sqrt(c[component])));
+                    }
+                }
+            }
+
+            levels.push_back(std::move(m));
+        }
+};
+
+#endif
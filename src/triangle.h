@@ -5,15 +5,72 @@
 
 class triangle : public hittable {
 public:
-    triangle(const point3& a, const point3& b, const point3& c, shared_ptr<material> mat) : points{ a, b, c }, mat{ mat } {}
+    triangle(const point3& a, const point3& b, const point3& c, shared_ptr<material> mat)
+        : triangle(a, b, c, vec3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0), mat) {}
+
+    // Texture coordinates are given per vertex as (u, v, 0).
+    triangle(const point3& a, const point3& b, const point3& c,
+             const vec3& uv_a, const vec3& uv_b, const vec3& uv_c, shared_ptr<material> mat)
+        : points{ a, b, c }, uvs{ uv_a, uv_b, uv_c }, mat{ mat } {
+        // Texture units per world unit, from the ratio of the uv and world space areas.
+        double world_area = cross(b - a, c - a).length();
+        double uv_area    = fabs(cross(uv_b - uv_a, uv_c - uv_a).z());
+        uv_scale = (world_area > 0) ? sqrt(uv_area / world_area) : 0;
+    }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        vec3   normal;
+        double dot_ray_normal;
+        double root;
+
+        if (!intersect(r, ray_t, normal, dot_ray_normal, root)) {
+            return false;
+        }
+
+        set_hit_record(r, root, normal, dot_ray_normal, rec);
+        return true;
+    }
+
+    void set_hit_record(const ray& r, double root, const vec3& normal, double dot_ray_normal, hit_record& rec) const {
+        set_hit_geometry(r, root, normal, dot_ray_normal, rec);
+        rec.mat = mat;
+    }
+
+    void set_hit_geometry(const ray& r, double root, const vec3& normal, double dot_ray_normal, hit_record& rec) const {
+        // Everything but the material, for callers that look materials up by index.
+        rec.front_face = true;
+        rec.normal = (dot_ray_normal > 0) ? -normal : normal;
+        rec.p = r.at(root);
+        rec.t = root;
+
+        // Barycentric weights of the first two vertices, from the sub-triangle areas.
+        double area = dot(normal, cross(points[1] - points[0], points[2] - points[0]));
+        double w0   = dot(normal, cross(points[2] - points[1], rec.p - points[1])) / area;
+        double w1   = dot(normal, cross(points[0] - points[2], rec.p - points[2])) / area;
+        vec3   uv   = w0 * uvs[0] + w1 * uvs[1] + (1 - w0 - w1) * uvs[2];
+        rec.u = uv.x();
+        rec.v = uv.y();
+        rec.footprint = r.cone_width_at(root) * uv_scale;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        vec3   normal;
+        double dot_ray_normal;
+        double root;
+
+        return intersect(r, ray_t, normal, dot_ray_normal, root);
+    }
+
+    bool intersect(const ray& r, interval ray_t, vec3& normal, double& dot_ray_normal, double& root) const {
+        // Finds the hit in `ray_t` without filling a hit record; see `set_hit_record`.
+        counters.intersection_tests++;
+
         vec3 ab = points[1] - points[0];
         vec3 ac = points[2] - points[0];
 
-        vec3 normal = unit_vector(cross(ab, ac));
+        normal = unit_vector(cross(ab, ac));
 
-        double dot_ray_normal = dot(normal, r.direction());
+        dot_ray_normal = dot(normal, r.direction());
 
         if (fabs(dot_ray_normal) < 1e-8) {
             return false;
@@ -26,7 +83,7 @@ public:
 
         double C = dot(normal, points[0]);
 
-        double root = (C - dot(normal, r.origin())) / dot(normal, r.direction());
+        root = (C - dot(normal, r.origin())) / dot_ray_normal;
 
         if (!ray_t.surrounds(root)) {
             return false;
@@ -34,28 +91,29 @@ public:
 
         point3 p = r.at(root);
 
-        vec3 C0 = p - points[0];
-        vec3 C1 = p - points[1];
-        vec3 C2 = p - points[2];
-
         if (dot(normal, cross(points[1] - points[0], p - points[0])) <= 0 ||
             dot(normal, cross(points[2] - points[1], p - points[1])) <= 0 ||
             dot(normal, cross(points[0] - points[2], p - points[2])) <= 0) {
             return false;
         }
 
-        rec.front_face = true;
-        rec.mat = mat;
-        rec.normal = (dot_ray_normal > 0) ? -normal : normal;
-        rec.p = p;
-        rec.t = root;
-
         return true;
     }
 
+    const point3& get_point(int i) const { return points[i]; }
+    const vec3& get_uv(int i) const { return uvs[i]; }
+    const shared_ptr<material>& get_material() const { return mat; }
+
+    aabb bounding_box() const override {
+        return aabb(aabb(points[0], points[1]), aabb(points[2], points[2]));
+    }
+
 private:
     point3               points[3];
+    vec3                 uvs[3];
     shared_ptr<material> mat;
+    double               uv_scale;
+
 };
 
 
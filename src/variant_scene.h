@@ -0,0 +1,185 @@
+#ifndef VARIANT_SCENE_H
+#define VARIANT_SCENE_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <typeinfo>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+using material_variant = std::variant<lambertian, metal, dielectric>;
+
+// A closed-set copy of a scene: spheres and triangles stored by value in one array per type, and
+// the built-in materials stored by value in a std::variant. Hits loop over each array with
+// non-virtual calls, and the camera scatters through `material_at`, which dispatches with
+// std::visit instead of a virtual call. Objects or materials of any other type are kept in an
+// ordinary hittable_list and go through the virtual path as before.
+class variant_scene final : public hittable {
+    public:
+        // Proxy for one of the scene's materials, with the same calls the camera makes on a
+        // `material`.
+        class material_ref {
+            public:
+                material_ref(const material_variant* closed, const material* open) : closed{ closed }, open{ open } {}
+
+                bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+                    if (!closed) return open->scatter(r_in, rec, attenuation, scattered);
+                    return std::visit([&](const auto& m) {
+                        using type = std::decay_t<decltype(m)>;
+                        return m.type::scatter(r_in, rec, attenuation, scattered);
+                    }, *closed);
+                }
+
+                bool diffuse_albedo(const hit_record& rec, color& albedo) const {
+                    if (!closed) return open->diffuse_albedo(rec, albedo);
+                    return std::visit([&](const auto& m) {
+                        using type = std::decay_t<decltype(m)>;
+                        return m.type::diffuse_albedo(rec, albedo);
+                    }, *closed);
+                }
+
+                double cone_spread() const {
+                    if (!closed) return open->cone_spread();
+                    return std::visit([&](const auto& m) {
+                        using type = std::decay_t<decltype(m)>;
+                        return m.type::cone_spread();
+                    }, *closed);
+                }
+
+            private:
+                const material_variant* closed;
+                const material*         open;
+        };
+
+        variant_scene(const hittable_list& list) {
+            for (const auto& object : list.objects) {
+                int material_index;
+                // Exact type matches only; copying a subclass by value would slice it.
+                const hittable& h = *object;
+                if (typeid(h) == typeid(sphere) && closed_material(static_cast<const sphere&>(h).get_material(), material_index)) {
+                    spheres.push_back(static_cast<const sphere&>(h));
+                    sphere_materials.push_back(material_index);
+                }
+                else if (typeid(h) == typeid(triangle) && closed_material(static_cast<const triangle&>(h).get_material(), material_index)) {
+                    triangles.push_back(static_cast<const triangle&>(h));
+                    triangle_materials.push_back(material_index);
+                }
+                else {
+                    others.add(object);
+                }
+            }
+        }
+
+        size_t closed_count() const { return spheres.size() + triangles.size(); }
+        size_t open_count() const { return others.objects.size(); }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            // Only the roots are found inside the loops; the hit record is filled once, for the
+            // closest hit, instead of for every closer candidate along the way. Closed-set hits
+            // carry `material_index` and no `mat`, which saves a reference count update per hit.
+            int    closest_sphere   = -1;
+            int    closest_triangle = -1;
+            vec3   triangle_normal;
+            double triangle_dot = 0;
+
+            for (size_t i = 0; i < spheres.size(); i++) {
+                double root;
+                if (spheres[i].sphere::intersect(r, ray_t, root)) {
+                    closest_sphere = int(i);
+                    ray_t.max = root;
+                }
+            }
+
+            for (size_t i = 0; i < triangles.size(); i++) {
+                vec3   normal;
+                double dot_ray_normal, root;
+                if (triangles[i].triangle::intersect(r, ray_t, normal, dot_ray_normal, root)) {
+                    closest_triangle = int(i);
+                    triangle_normal  = normal;
+                    triangle_dot     = dot_ray_normal;
+                    ray_t.max = root;
+                }
+            }
+
+            if (!others.objects.empty() && others.hit(r, ray_t, rec)) {
+                rec.material_index = -1;
+                return true;
+            }
+
+            if (closest_triangle >= 0) {
+                triangles[closest_triangle].set_hit_geometry(r, ray_t.max, triangle_normal, triangle_dot, rec);
+                rec.mat.reset();
+                rec.material_index = triangle_materials[closest_triangle];
+                return true;
+            }
+
+            if (closest_sphere >= 0) {
+                spheres[closest_sphere].set_hit_geometry(r, ray_t.max, rec);
+                rec.mat.reset();
+                rec.material_index = sphere_materials[closest_sphere];
+                return true;
+            }
+
+            return false;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            for (const auto& s : spheres) {
+                if (s.sphere::occluded(r, ray_t)) return true;
+            }
+            for (const auto& t : triangles) {
+                if (t.triangle::occluded(r, ray_t)) return true;
+            }
+            return !others.objects.empty() && others.occluded(r, ray_t);
+        }
+
+        aabb bounding_box() const override {
+            aabb bbox = others.bounding_box();
+            for (const auto& s : spheres)   bbox = aabb(bbox, s.sphere::bounding_box());
+            for (const auto& t : triangles) bbox = aabb(bbox, t.triangle::bounding_box());
+            return bbox;
+        }
+
+        material_ref material_at(const hit_record& rec) const {
+            if (rec.material_index < 0) {
+                return material_ref(nullptr, rec.mat.get());
+            }
+            return material_ref(&materials[rec.material_index], nullptr);
+        }
+
+    private:
+        std::vector<sphere>                           spheres;
+        std::vector<int>                              sphere_materials;
+        std::vector<triangle>                         triangles;
+        std::vector<int>                              triangle_materials;
+        std::vector<material_variant>                 materials;
+        std::unordered_map<const material*, int>      material_indices;
+        hittable_list                                 others;
+
+        bool closed_material(const shared_ptr<material>& mat, int& index) {
+            // Finds or adds the by-value copy of `mat`. Returns false for material types outside
+            // the closed set.
+            auto known = material_indices.find(mat.get());
+            if (known != material_indices.end()) {
+                index = known->second;
+                return true;
+            }
+
+            const material& m = *mat;
+            if (typeid(m) == typeid(lambertian))      materials.emplace_back(static_cast<const lambertian&>(m));
+            else if (typeid(m) == typeid(metal))      materials.emplace_back(static_cast<const metal&>(m));
+            else if (typeid(m) == typeid(dielectric)) materials.emplace_back(static_cast<const dielectric&>(m));
+            else return false;
+
+            index = int(materials.size()) - 1;
+            material_indices[mat.get()] = index;
+            return true;
+        }
+};
+
+#endif
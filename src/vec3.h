@@ -107,26 +107,66 @@ inline vec3 unit_vector(const vec3& v) {
     return v / v.length();
 }
 
-inline vec3 random_in_unit_disk() {
-    while (true) {
-        vec3 p = vec3(random_double(-1.0, 1.0), random_double(-1.0, 1.0), 0);
-        if (p.length_squared() <= 1) {
-            return unit_vector(p);
-        }
+// Sampling warps. Each one maps uniform random numbers to the wanted distribution in closed form,
+// so every sample costs the same fixed number of random draws, with no rejection loop.
+
+inline vec3 concentric_disk(double u1, double u2) {
+    // Shirley and Chiu's concentric map from [0,1)^2 to the unit disk. It keeps neighbouring
+    // samples close together and spreads them evenly over the disk.
+    double a = 2 * u1 - 1;
+    double b = 2 * u2 - 1;
+    if (a == 0 && b == 0) {
+        return vec3(0, 0, 0);
     }
-}
 
-inline vec3 random_in_unit_sphere() {
-    while (true) {
-        vec3 p = vec3::random(-1, 1);
-        if (p.length_squared() <= 1) {
-            return p;
-        }
+    double r, phi;
+    if (fabs(a) > fabs(b)) {
+        r   = a;
+        phi = (pi / 4) * (b / a);
     }
+    else {
+        r   = b;
+        phi = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(r * cos(phi), r * sin(phi), 0);
+}
+
+inline vec3 uniform_sphere(double u1, double u2) {
+    // Archimedes: height and angle around the axis are both uniform on the sphere.
+    double z   = 1 - 2 * u1;
+    double r   = sqrt(fmax(0.0, 1 - z * z));
+    double phi = 2 * pi * u2;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+inline vec3 cosine_hemisphere(double u1, double u2) {
+    // Malley's method: a uniform disk sample lifted onto the hemisphere around +z.
+    vec3 d = concentric_disk(u1, u2);
+    return vec3(d.x(), d.y(), sqrt(fmax(0.0, 1 - d.x() * d.x() - d.y() * d.y())));
+}
+
+inline vec3 to_normal_frame(const vec3& unit_normal, const vec3& local) {
+    // Rotates `local`, given around +z, to lie around `unit_normal`. Uses the branchless
+    // orthonormal basis of Duff et al.
+    double sign = std::copysign(1.0, unit_normal.z());
+    double a    = -1 / (sign + unit_normal.z());
+    double b    = unit_normal.x() * unit_normal.y() * a;
+    vec3   tangent(1 + sign * unit_normal.x() * unit_normal.x() * a, sign * b, -sign * unit_normal.x());
+    vec3   bitangent(b, sign + unit_normal.y() * unit_normal.y() * a, -unit_normal.y());
+    return local.x() * tangent + local.y() * bitangent + local.z() * unit_normal;
+}
+
+inline vec3 random_in_unit_disk() {
+    return concentric_disk(random_double(), random_double());
 }
 
 inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+    return uniform_sphere(random_double(), random_double());
+}
+
+inline vec3 random_in_unit_sphere() {
+    // A direction, scaled by the cube root so the points are uniform in volume.
+    return std::cbrt(random_double()) * random_unit_vector();
 }
 
 inline vec3 random_on_hemisphere(const vec3& normal) {